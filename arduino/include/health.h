@@ -0,0 +1,30 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include "serialhandler.h"
+#include "muonpi_lmic.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// MSG_HEALTH payload, counters are totals since boot
+struct __attribute__((packed)) HealthFrame
+{
+    uint16_t free_sram;           // between heap top and stack
+    uint16_t largest_block;       // largest block malloc() could still hand out
+    uint8_t serial_rx_high_water; // most bytes seen waiting in the UART receive buffer
+    uint8_t queue_depth;          // uplinks waiting for the radio
+    uint16_t opmode;              // LMIC.opmode
+    uint8_t datarate;             // LMIC.datarate
+    uint32_t seqno_up;            // LMIC.seqnoUp
+    uint16_t rejected_checksum;   // serial frames dropped for a bad checksum
+    uint16_t rejected_overflow;   // uplinks refused, queue full or too long
+    uint8_t serial_ring_high_water; // most bytes drained from the UART and not parsed yet, of SERIAL_RING_SIZE
+    uint32_t uptime_s;              // since boot, lower than in the previous report means the arduino rebooted
+};
+
+uint16_t freeSram();
+uint16_t largestFreeBlock();
+uint32_t uptimeSeconds();
+void reportHealth(SerialHandler *serial_handler, const MuonPiLMIC *lmic);
+
+#endif // HEALTH_H
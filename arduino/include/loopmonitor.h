@@ -0,0 +1,39 @@
+#ifndef LOOPMONITOR_H
+#define LOOPMONITOR_H
+
+#include "serialhandler.h"
+#include <Arduino.h>
+#include <stdint.h>
+#include <lmic.h>
+
+// MSG_LOOP_STATS payload, all values since the previous report
+struct __attribute__((packed)) LoopStatsFrame
+{
+    uint32_t loop_max_us;    // longest pass through loop()
+    uint32_t loop_avg_us;
+    uint32_t loops;
+    uint32_t deferred;       // passes that skipped serial work for an upcoming LMIC job
+    uint32_t rx_late_max_us; // how far the RX window job ran behind its scheduled time
+    uint32_t job_late_max_us; // the same for any timed LMIC job
+    uint16_t rx_windows;
+    uint16_t rx_missed;      // windows opened after LMIC.rxtime
+};
+
+class LoopMonitor
+{
+public:
+    void tick();
+    void resume();
+    void deferred();
+    void rxStart();
+    void jobDue(ostime_t deadline);
+    void report(SerialHandler *serial_handler);
+
+private:
+    unsigned long m_last_tick{0};
+    bool m_started{false};
+    uint32_t m_loop_sum{0};
+    LoopStatsFrame m_stats{};
+};
+
+#endif // LOOPMONITOR_H
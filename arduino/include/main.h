@@ -22,6 +22,13 @@
 
 #define DEFAULT_BAUD 9600
 
+// Bytes parsed per pass of loop(), keeps parsing short between LMIC jobs
+#define SERIAL_BYTE_BUDGET 32
+// Serial work is skipped while an LMIC job is due within this many milliseconds
+#define LMIC_JOB_SLACK_MS 5
+// Seconds between two loop statistics and health reports
+#define STATS_INTERVAL 60
+
 // #define TX_INTERVAL 10
 
     // -----------------------------------------------------------------------------
@@ -15,6 +15,7 @@
 #define __MuonPiLMIC__
 
 #include "serialhandler.h"
+#include "loopmonitor.h"
 #include <Arduino.h>
 #include <Wire.h>
 #include <lmic.h>
@@ -22,17 +23,55 @@
 
 #define LMIC_CLOCK_ERROR_PPM 30000
 
+// Uplinks waiting for the radio, LMIC itself only holds the one being sent
+#define UPLINK_QUEUE_SIZE 4
+// Largest FRMPayload at SF12 in EU868, longer uplinks are refused
+#define UPLINK_MAX_PAYLOAD 51
+// FPorts an uplink may use, 0 carries MAC commands and 224 and up are reserved
+#define UPLINK_MIN_PORT 1
+#define UPLINK_MAX_PORT 223
+// MHDR, FHDR without FOpts, FPort and MIC around the FRMPayload
+#define LORAWAN_FRAME_OVERHEAD 13
+#define UPLINK_MAX_FRAME (UPLINK_MAX_PAYLOAD + LORAWAN_FRAME_OVERHEAD)
+// dBm for raw frames, the EU868 limit of the g-band
+#define RAW_TX_POWER 14
+
+struct Uplink
+{
+    uint8_t id; // chosen by the raspi, echoed in MSG_UPLINK_STATUS
+    bool raw;   // complete PHYPayload from the raspi, put on air as it is
+    uint8_t port;
+    uint8_t len;
+    uint8_t data[UPLINK_MAX_FRAME];
+};
+
 class MuonPiLMIC
 {
 public:
-    bool setup(devaddr_t devaddr, unsigned char *appskey, unsigned char *nwkskey, SerialHandler *f_serial_handler = nullptr);
-    void sendLoraPayload(uint8_t port, String &message); // port can be chosen at will
+    bool setup(devaddr_t devaddr, unsigned char *appskey, unsigned char *nwkskey, SerialHandler *f_serial_handler = nullptr, LoopMonitor *f_loop_monitor = nullptr);
+    bool sendLoraPayload(uint8_t port, uint8_t id, const uint8_t *data, uint8_t len); // port from UPLINK_MIN_PORT to UPLINK_MAX_PORT
+    bool sendRawFrame(uint8_t id, const uint8_t *frame, uint8_t len);
+    uint8_t queueDepth() const;
+    uint16_t rejectedOverflow() const;
     static void do_send(osjob_t *sendjob);
     static void onEvent(void *pUserData, ev_t ev);
 
 private:
+    static bool enqueue(uint8_t id, bool raw, uint8_t port, const uint8_t *data, uint8_t len, uint8_t max_len);
+    static void rawTxStart(osjob_t *job);
+    static void rawTxDone(osjob_t *job);
+    static void sendStatus(uint8_t id, UplinkStatus status);
+
     static SerialHandler *m_serial_handler;
-    static String data;
+    static LoopMonitor *m_loop_monitor;
+    static Uplink m_queue[UPLINK_QUEUE_SIZE];
+    static uint8_t m_queue_head;
+    static uint8_t m_queue_count;
+    static uint16_t m_rejected_overflow;
+    static uint8_t m_tx_id;
+    static bool m_tx_active;
+    static ostime_t m_raw_band_free;
+    static uint8_t m_raw_channel;
 };
 
 #ifdef __cplusplus
@@ -6,18 +6,90 @@
 #include <lmic.h>
 #include <hal/hal.h>
 
+// first payload byte of every serial frame, keep in sync with console_test/include/serial.h
+enum MessageType : uint8_t
+{
+    MSG_NONE = 0x00,
+    MSG_UPLINK = 0x01,         // raspi -> arduino: <id> <fport> <lora payload>
+    MSG_LOG = 0x02,            // arduino -> raspi: <status text>
+    MSG_UPLINK_STATUS = 0x03,  // arduino -> raspi: <id> <UplinkStatus>
+    MSG_UPLINK_RAW = 0x04,     // raspi -> arduino: <id> <PHYPayload built and encrypted by the raspi>
+    MSG_BAUD_PROPOSE = 0x10,   // raspi -> arduino: <baud u32 le>
+    MSG_BAUD_ACK = 0x11,       // arduino -> raspi: <baud u32 le>, 0 if the rate is refused
+    MSG_BAUD_CONFIRM = 0x12,   // both directions, first frame at the new rate
+    MSG_LOOP_STATS = 0x20,     // arduino -> raspi: see LoopMonitor::report()
+    MSG_LOOP_STATS_REQ = 0x21, // raspi -> arduino: report loop stats now
+    MSG_HEALTH = 0x22,         // arduino -> raspi: see HealthFrame
+    MSG_HEALTH_REQ = 0x23,     // raspi -> arduino: report health now
+};
+
+enum UplinkStatus : uint8_t
+{
+    UPLINK_REJECTED = 0x00, // queue full or too long, the raspi may resend it
+    UPLINK_DONE = 0x01,     // LMIC reported EV_TXCOMPLETE, or the raw frame went out
+    UPLINK_QUEUED = 0x02,   // accepted into the queue, SENDING and DONE or REJECTED follow
+    UPLINK_SENDING = 0x03,  // the radio started transmitting it, the raspi must not resend it
+};
+
+constexpr uint8_t MAX_FRAME_PAYLOAD = 0xfbu; // type + data
+// largest frame the raspi sends, MSG_UPLINK_RAW: type + id + UPLINK_MAX_FRAME
+constexpr uint8_t MAX_INBOUND_PAYLOAD = 66;
+// bytes drained from Serial and not parsed yet, a power of two; the 64 byte hardware
+// buffer fills in 640 us at 1 Mbaud, so it is emptied on every pass of loop()
+constexpr uint8_t SERIAL_RING_SIZE = 128;
+
+constexpr unsigned long BAUD_CONFIRM_TIMEOUT = 2000; // ms to wait for the confirm before reverting
+constexpr unsigned long BAUD_SILENCE_TIMEOUT = 6000; // ms without a valid frame before falling back, three raspi pings
+
 class SerialHandler
 {
 
 public:
     SerialHandler() = default;
-    bool read(String &data);
-    void fletcherChkSum(const String &buf, uint8_t &chkA, uint8_t &chkB);
+    void begin(uint32_t safe_baud);
+    void pump();
+    uint8_t read(const uint8_t *&data, uint8_t &len, uint8_t budget);
     bool send(const char *data);
     bool send(const String &data);
+    bool send(uint8_t type, const uint8_t *data, size_t len);
+    uint8_t rxHighWater() const;
+    uint8_t ringHighWater() const;
+    uint16_t rejectedChecksum() const;
 
 private:
-    String buf{};
+    enum ParseState : uint8_t
+    {
+        PARSE_HEADER,
+        PARSE_SIZE,
+        PARSE_PAYLOAD,
+        PARSE_CHKA,
+        PARSE_CHKB,
+    };
+
+    bool parse(uint8_t byte);
+    void handleControl();
+    void switchBaud(uint32_t baud);
+    void checkBaud();
+    static bool baudSupported(uint32_t baud);
+
+    uint8_t m_ring[SERIAL_RING_SIZE]{};
+    uint8_t m_ring_head{0}; // free running, wrap with the ring size
+    uint8_t m_ring_tail{0};
+    uint8_t m_frame[MAX_INBOUND_PAYLOAD]{};
+    uint8_t m_frame_size{0};
+    uint8_t m_frame_pos{0};
+    uint8_t m_chkA{0};
+    uint8_t m_chkB{0};
+    ParseState m_state{PARSE_HEADER};
+    uint32_t m_safe_baud{0};
+    uint32_t m_baud{0};
+    uint32_t m_previous_baud{0};
+    bool m_baud_pending{false};
+    unsigned long m_baud_deadline{0};
+    unsigned long m_last_frame{0};
+    uint8_t m_rx_high_water{0};
+    uint8_t m_ring_high_water{0};
+    uint16_t m_rejected_checksum{0};
 };
 
-#endif // SERIALHANDLER_H
\ No newline at end of file
+#endif // SERIALHANDLER_H
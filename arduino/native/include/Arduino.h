@@ -0,0 +1,75 @@
+/*
+ * Arduino core shim for the native environment. Only what the firmware uses is
+ * here. Time is the real monotonic clock plus an offset the simulation can
+ * advance, see native_shim.h.
+ */
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define memcpy_P memcpy
+#define SERIAL_8N1 0x06
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// heap backed like the AVR one, allocations are counted for the footprint report
+class String
+{
+public:
+    String(const char *cstr = "");
+    String(const __FlashStringHelper *str);
+    String(const String &other);
+    String(String &&other) noexcept;
+    explicit String(unsigned char value, unsigned char base = 10);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    ~String();
+
+    String &operator=(const String &rhs);
+    String &operator=(String &&rhs) noexcept;
+    String &operator+=(const String &rhs);
+    String &operator+=(char c);
+    friend String operator+(const String &lhs, const String &rhs);
+
+    unsigned int length() const { return m_len; }
+    const char *c_str() const { return m_buffer != nullptr ? m_buffer : ""; }
+    char operator[](unsigned int index) const { return index < m_len ? m_buffer[index] : 0; }
+
+private:
+    void append(const char *data, unsigned int len);
+    void fromNumber(unsigned long value, bool negative, unsigned char base);
+
+    char *m_buffer{nullptr};
+    unsigned int m_len{0};
+    unsigned int m_capacity{0};
+};
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud, uint8_t config = SERIAL_8N1);
+    void end();
+    int available();
+    int read();
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buffer, size_t size);
+    void flush();
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // NATIVE_ARDUINO_H
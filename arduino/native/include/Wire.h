@@ -0,0 +1,5 @@
+// Wire shim for the native environment, nothing in the firmware talks I2C yet
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+#endif // NATIVE_WIRE_H
@@ -0,0 +1,185 @@
+/*
+ * Mock of the MCCI LMIC API for the native environment. The os_* scheduler
+ * behaves like the real one, the radio is simulated: a queued uplink starts
+ * when the band is free again (1% duty cycle), takes the LoRa airtime of its
+ * data rate and opens RX1 and RX2 one and two seconds after the end of TX.
+ * As in MCCI LMIC, LMIC_setTxData2() only sets OP_TXDATA while the uplink waits
+ * for the band, OP_TXRXPEND joins it when the TX starts, EV_TXCOMPLETE clears both.
+ * Nothing is ever received. os_radio(RADIO_TX) sends LMIC.frame right away,
+ * without duty cycle, and runs LMIC.osjob.func once the airtime has passed.
+ */
+#ifndef NATIVE_LMIC_H
+#define NATIVE_LMIC_H
+
+#include <stdint.h>
+
+typedef uint8_t bit_t;
+typedef uint8_t u1_t;
+typedef int8_t s1_t;
+typedef uint16_t u2_t;
+typedef int16_t s2_t;
+typedef uint32_t u4_t;
+typedef int32_t s4_t;
+typedef s4_t ostime_t;
+typedef u4_t devaddr_t;
+typedef u1_t dr_t;
+typedef u2_t rps_t; // the data rate itself here, LMIC packs SF, BW and CR
+
+#define US_PER_OSTICK 16
+#define OSTICKS_PER_SEC (1000000 / US_PER_OSTICK)
+#define us2osticks(us) ((ostime_t)(us) / US_PER_OSTICK)
+#define ms2osticks(ms) ((ostime_t)(ms) * (1000 / US_PER_OSTICK))
+#define sec2osticks(sec) ((ostime_t)(sec) * OSTICKS_PER_SEC)
+#define osticks2us(os) ((s4_t)(os) * US_PER_OSTICK)
+#define osticks2ms(os) ((s4_t)(os) / (1000 / US_PER_OSTICK))
+
+struct osjob_t;
+typedef void (*osjobcb_t)(struct osjob_t *);
+struct osjob_t
+{
+    struct osjob_t *next;
+    ostime_t deadline;
+    osjobcb_t func;
+};
+
+enum _ev_t
+{
+    EV_SCAN_TIMEOUT = 1,
+    EV_BEACON_FOUND,
+    EV_BEACON_MISSED,
+    EV_BEACON_TRACKED,
+    EV_JOINING,
+    EV_JOINED,
+    EV_RFU1,
+    EV_JOIN_FAILED,
+    EV_REJOIN_FAILED,
+    EV_TXCOMPLETE,
+    EV_LOST_TSYNC,
+    EV_RESET,
+    EV_RXCOMPLETE,
+    EV_LINK_DEAD,
+    EV_LINK_ALIVE,
+    EV_SCAN_FOUND,
+    EV_TXSTART,
+    EV_TXCANCELED,
+    EV_RXSTART,
+    EV_JOIN_TXCOMPLETE,
+};
+typedef enum _ev_t ev_t;
+
+// EU868
+enum _dr_eu868_t
+{
+    DR_SF12 = 0,
+    DR_SF11,
+    DR_SF10,
+    DR_SF9,
+    DR_SF8,
+    DR_SF7,
+    DR_SF7B,
+    DR_FSK,
+    DR_NONE
+};
+#define DR_RANGE_MAP(drlo, drhi) ((u2_t)((1 << (drhi + 1)) - (1 << drlo)))
+
+enum
+{
+    BAND_MILLI = 0,
+    BAND_CENTI = 1,
+    BAND_DECI = 2,
+    BAND_AUX = 3
+};
+
+enum
+{
+    OP_NONE = 0x0000,
+    OP_SCAN = 0x0001,
+    OP_TRACK = 0x0002,
+    OP_JOINING = 0x0004,
+    OP_TXDATA = 0x0008,
+    OP_POLL = 0x0010,
+    OP_REJOIN = 0x0020,
+    OP_SHUTDOWN = 0x0040,
+    OP_TXRXPEND = 0x0080,
+    OP_RNDTX = 0x0100,
+    OP_PINGINI = 0x0200,
+    OP_PINGABLE = 0x0400,
+    OP_NEXTCHNL = 0x0800,
+    OP_LINKDEAD = 0x1000,
+    OP_TESTMODE = 0x2000,
+    OP_UNJOIN = 0x4000,
+};
+
+enum
+{
+    TXRX_ACK = 0x80,
+    TXRX_NACK = 0x40,
+    TXRX_NOPORT = 0x20,
+    TXRX_PORT = 0x10,
+    TXRX_DNW1 = 0x01,
+    TXRX_DNW2 = 0x02,
+    TXRX_PING = 0x04,
+};
+
+#define MAX_CLOCK_ERROR 65536
+#define MAX_LEN_FRAME 64
+#define MAX_CHANNELS 16
+#define RADIO_RST 0
+#define RADIO_TX 1
+#define LMIC_ERROR_SUCCESS 0
+#define LMIC_ERROR_TX_BUSY -1
+#define LMIC_ERROR_TX_TOO_LARGE -2
+
+typedef void lmic_event_cb_t(void *pUserData, ev_t e);
+typedef int lmic_tx_error_t;
+
+struct lmic_t
+{
+    osjob_t osjob;
+    ostime_t txend;
+    ostime_t rxtime;
+    u4_t seqnoUp;
+    u2_t opmode;
+    dr_t datarate;
+    dr_t dn2Dr;
+    u1_t txrxFlags;
+    u1_t dataLen;
+    u4_t freq;
+    rps_t rps;
+    s1_t radio_txpow; // what the radio driver's configPower() uses, the MAC level txpow is left out on purpose
+    u4_t channelFreq[MAX_CHANNELS]; // frequency | band
+    u1_t pendTxPort;
+    u1_t pendTxLen;
+    u1_t pendTxData[MAX_LEN_FRAME];
+    u1_t frame[MAX_LEN_FRAME];
+};
+
+extern struct lmic_t LMIC;
+
+void os_init(void);
+ostime_t os_getTime(void);
+void os_setCallback(osjob_t *job, osjobcb_t cb);
+void os_setTimedCallback(osjob_t *job, ostime_t time, osjobcb_t cb);
+void os_clearCallback(osjob_t *job);
+void os_runloop_once(void);
+bit_t os_queryTimeCriticalJobs(ostime_t time);
+ostime_t os_getNextDeadline(bit_t *valid);
+
+void LMIC_reset(void);
+void LMIC_setSession(u4_t netid, devaddr_t devaddr, const u1_t *nwkKey, const u1_t *artKey);
+bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t band);
+void LMIC_setLinkCheckMode(bit_t enabled);
+void LMIC_setDrTxpow(dr_t dr, s1_t txpow);
+void LMIC_setAdrMode(bit_t enabled);
+void LMIC_setClockError(u2_t error);
+int LMIC_registerEventCb(lmic_event_cb_t *pEventCb, void *pUserData);
+lmic_tx_error_t LMIC_setTxData2(u1_t port, const u1_t *data, u1_t dlen, u1_t confirmed);
+
+void os_radio(u1_t mode);
+ostime_t calcAirTime(rps_t rps, u1_t plen);
+static inline rps_t updr2rps(dr_t dr)
+{
+    return dr;
+}
+
+#endif // NATIVE_LMIC_H
@@ -0,0 +1,35 @@
+/*
+ * Hooks into the native shims for the simulation and benchmarks, the firmware
+ * itself never includes this.
+ */
+#ifndef NATIVE_SHIM_H
+#define NATIVE_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include <lmic.h>
+
+// time
+void nativeAdvance(unsigned long us);
+
+// the raspi side of the serial line
+size_t nativeSerialInject(const uint8_t *data, size_t len); // into the 64 byte RX buffer, returns what fit
+std::vector<uint8_t> nativeSerialTakeTx(); // bytes that left the TX buffer on the wire so far
+size_t nativeSerialTxPending();            // bytes still in the TX buffer
+unsigned long nativeSerialTxBlocked();     // us write() and flush() waited for room in total
+unsigned long nativeSerialBaud();
+unsigned long nativeSerialOverruns(); // bytes that did not fit the RX buffer
+
+// String heap usage
+size_t nativeHeapCurrent();
+size_t nativeHeapPeak();
+unsigned long nativeHeapAllocations();
+
+// LMIC scheduler and the simulated radio
+bool nativeNextDeadline(ostime_t &deadline); // earliest timed job, false if none
+bool nativeJobRunnable();
+unsigned long nativeTxCount();
+
+#endif // NATIVE_SHIM_H
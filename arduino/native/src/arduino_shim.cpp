@@ -0,0 +1,362 @@
+#include <Arduino.h>
+#include "native_shim.h"
+
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <deque>
+
+HardwareSerial Serial;
+
+namespace
+{
+const auto start = std::chrono::steady_clock::now();
+unsigned long time_offset_us{0};
+
+size_t heap_current{0};
+size_t heap_peak{0};
+unsigned long heap_allocations{0};
+
+// the AVR core keeps a 64 byte ring buffer per direction, received bytes beyond that are lost
+uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE]{};
+size_t rx_head{0};
+size_t rx_count{0};
+unsigned long rx_overruns{0};
+unsigned long serial_baud{0};
+
+// The TX side drains at the baud rate, 10 bits per byte. write() blocks while the
+// buffer is full and flush() until it is empty, as on the AVR, by advancing the
+// simulated time, so the time the firmware spends in send() shows in its latencies.
+// The byte in the UART shift register counts as the oldest one in the buffer.
+struct TxByte
+{
+    uint8_t byte;
+    double done_us; // when its stop bit is out
+};
+std::deque<TxByte> tx_ring{};
+std::vector<uint8_t> tx_wire{};
+unsigned long tx_blocked_us{0};
+
+uint64_t nowUs()
+{
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return elapsed.count() + time_offset_us;
+}
+
+void txDrain()
+{
+    const double now = static_cast<double>(nowUs());
+    while (!tx_ring.empty() && tx_ring.front().done_us <= now)
+    {
+        tx_wire.push_back(tx_ring.front().byte);
+        tx_ring.pop_front();
+    }
+}
+
+// blocks until the byte done at done_us left
+void txWaitFor(double done_us)
+{
+    const double now = static_cast<double>(nowUs());
+    if (done_us > now)
+    {
+        const unsigned long wait = static_cast<unsigned long>(done_us - now) + 1;
+        nativeAdvance(wait);
+        tx_blocked_us += wait;
+    }
+    txDrain();
+}
+
+void txPut(uint8_t byte)
+{
+    txDrain();
+    while (tx_ring.size() >= SERIAL_TX_BUFFER_SIZE)
+    {
+        txWaitFor(tx_ring.front().done_us);
+    }
+    const double byte_us = 10e6 / static_cast<double>(serial_baud);
+    const double now = static_cast<double>(nowUs());
+    const double after = tx_ring.empty() ? now : tx_ring.back().done_us;
+    tx_ring.push_back({byte, (after > now ? after : now) + byte_us});
+}
+} // namespace
+
+unsigned long micros()
+{
+    // 32 bit like on the AVR so wrap around behaves the same
+    return static_cast<uint32_t>(nowUs());
+}
+
+unsigned long millis()
+{
+    return static_cast<uint32_t>(nowUs() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void nativeAdvance(unsigned long us)
+{
+    time_offset_us += us;
+}
+
+// ======================================================================================
+
+String::String(const char *cstr)
+{
+    append(cstr, static_cast<unsigned int>(strlen(cstr)));
+}
+
+String::String(const __FlashStringHelper *str)
+    : String(reinterpret_cast<const char *>(str)) {}
+
+String::String(const String &other)
+{
+    append(other.c_str(), other.m_len);
+}
+
+String::String(String &&other) noexcept
+    : m_buffer{other.m_buffer}
+    , m_len{other.m_len}
+    , m_capacity{other.m_capacity}
+{
+    other.m_buffer = nullptr;
+    other.m_len = 0;
+    other.m_capacity = 0;
+}
+
+String::String(unsigned char value, unsigned char base)
+{
+    fromNumber(value, false, base);
+}
+
+String::String(int value, unsigned char base)
+{
+    fromNumber(value < 0 ? -static_cast<unsigned long>(value) : value, value < 0, base);
+}
+
+String::String(unsigned int value, unsigned char base)
+{
+    fromNumber(value, false, base);
+}
+
+String::String(long value, unsigned char base)
+{
+    fromNumber(value < 0 ? -static_cast<unsigned long>(value) : value, value < 0, base);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+    fromNumber(value, false, base);
+}
+
+String::~String()
+{
+    if (m_buffer != nullptr)
+    {
+        heap_current -= m_capacity + 1;
+        free(m_buffer);
+    }
+}
+
+String &String::operator=(const String &rhs)
+{
+    if (this != &rhs)
+    {
+        m_len = 0;
+        append(rhs.c_str(), rhs.m_len);
+    }
+    return *this;
+}
+
+String &String::operator=(String &&rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        this->~String();
+        m_buffer = rhs.m_buffer;
+        m_len = rhs.m_len;
+        m_capacity = rhs.m_capacity;
+        rhs.m_buffer = nullptr;
+        rhs.m_len = 0;
+        rhs.m_capacity = 0;
+    }
+    return *this;
+}
+
+String &String::operator+=(const String &rhs)
+{
+    append(rhs.c_str(), rhs.m_len);
+    return *this;
+}
+
+String &String::operator+=(char c)
+{
+    append(&c, 1);
+    return *this;
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+    String result{lhs};
+    result += rhs;
+    return result;
+}
+
+void String::append(const char *data, unsigned int len)
+{
+    if (m_len + len > m_capacity || m_buffer == nullptr)
+    {
+        // realloc to the exact size, as WString.cpp does
+        const unsigned int capacity = m_len + len;
+        char *buffer = static_cast<char *>(realloc(m_buffer, capacity + 1));
+        if (buffer == nullptr)
+        {
+            return;
+        }
+        heap_current += capacity - m_capacity + (m_buffer == nullptr ? 1 : 0);
+        heap_allocations++;
+        if (heap_current > heap_peak)
+        {
+            heap_peak = heap_current;
+        }
+        m_buffer = buffer;
+        m_capacity = capacity;
+    }
+    memcpy(m_buffer + m_len, data, len);
+    m_len += len;
+    m_buffer[m_len] = '\0';
+}
+
+void String::fromNumber(unsigned long value, bool negative, unsigned char base)
+{
+    char digits[34]{};
+    int pos = sizeof(digits) - 1;
+    do
+    {
+        const unsigned digit = value % base;
+        digits[--pos] = static_cast<char>(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value != 0 && pos > 1);
+    if (negative)
+    {
+        digits[--pos] = '-';
+    }
+    append(&digits[pos], static_cast<unsigned int>(sizeof(digits) - 1 - pos));
+}
+
+size_t nativeHeapCurrent()
+{
+    return heap_current;
+}
+
+size_t nativeHeapPeak()
+{
+    return heap_peak;
+}
+
+unsigned long nativeHeapAllocations()
+{
+    return heap_allocations;
+}
+
+// ======================================================================================
+
+void HardwareSerial::begin(unsigned long baud, uint8_t config)
+{
+    serial_baud = baud;
+}
+
+void HardwareSerial::end()
+{
+    // the AVR core lets the TX buffer drain first, too
+    flush();
+    rx_head = 0;
+    rx_count = 0;
+}
+
+int HardwareSerial::available()
+{
+    return static_cast<int>(rx_count);
+}
+
+int HardwareSerial::read()
+{
+    if (rx_count == 0)
+    {
+        return -1;
+    }
+    const uint8_t byte = rx_buffer[rx_head];
+    rx_head = (rx_head + 1) % SERIAL_RX_BUFFER_SIZE;
+    rx_count--;
+    return byte;
+}
+
+size_t HardwareSerial::write(uint8_t byte)
+{
+    txPut(byte);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        txPut(buffer[i]);
+    }
+    return size;
+}
+
+void HardwareSerial::flush()
+{
+    if (!tx_ring.empty())
+    {
+        txWaitFor(tx_ring.back().done_us);
+    }
+}
+
+size_t nativeSerialInject(const uint8_t *data, size_t len)
+{
+    size_t accepted{0};
+    for (; accepted < len; accepted++)
+    {
+        if (rx_count == SERIAL_RX_BUFFER_SIZE)
+        {
+            rx_overruns += len - accepted;
+            break;
+        }
+        rx_buffer[(rx_head + rx_count) % SERIAL_RX_BUFFER_SIZE] = data[accepted];
+        rx_count++;
+    }
+    return accepted;
+}
+
+std::vector<uint8_t> nativeSerialTakeTx()
+{
+    txDrain();
+    std::vector<uint8_t> out{};
+    out.swap(tx_wire);
+    return out;
+}
+
+unsigned long nativeSerialTxBlocked()
+{
+    return tx_blocked_us;
+}
+
+size_t nativeSerialTxPending()
+{
+    txDrain();
+    return tx_ring.size();
+}
+
+unsigned long nativeSerialBaud()
+{
+    return serial_baud;
+}
+
+unsigned long nativeSerialOverruns()
+{
+    return rx_overruns;
+}
@@ -0,0 +1,398 @@
+/*
+ * Benchmarks for the firmware logic on the build machine:
+ *  - static RAM footprint of the firmware objects and String heap usage
+ *  - per byte cost of the serial frame parser, for valid frames and for garbage
+ *  - the whole event path, setup() and loop() from main.cpp against a simulated raspi
+ *    keeping its window of uplinks in flight, first at the start rate, then at the
+ *    rate it negotiated, reporting rejects, lost bytes, loop latency, time blocked on a
+ *    full serial TX buffer and RX timing
+ * Times are host CPU times, compare them between builds rather than to the AVR.
+ */
+#include <Arduino.h>
+#include <lmic.h>
+#include "native_shim.h"
+#include "main.h"
+#include "serialhandler.h"
+#include "muonpi_lmic.h"
+#include "loopmonitor.h"
+#include "health.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+void setup();
+void loop();
+extern LoopMonitor *loop_monitor;
+
+namespace
+{
+constexpr uint8_t header{0xf9u};
+
+std::vector<uint8_t> frame(uint8_t type, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> out{};
+    out.reserve(data.size() + 5);
+    out.push_back(header);
+    out.push_back(static_cast<uint8_t>(data.size() + 1));
+    out.push_back(type);
+    out.insert(out.end(), data.begin(), data.end());
+    uint8_t chkA = 0, chkB = 0;
+    for (size_t i = 2; i < out.size(); i++)
+    {
+        chkA += out[i];
+        chkB += chkA;
+    }
+    out.push_back(chkA);
+    out.push_back(chkB);
+    return out;
+}
+
+// splits the arduino's output back into frames
+struct TxFrames
+{
+    std::vector<uint8_t> buf{};
+
+    bool next(uint8_t &type, std::vector<uint8_t> &data)
+    {
+        size_t i = 0;
+        while (i + 4 <= buf.size())
+        {
+            const uint8_t size = buf[i + 1];
+            if (buf[i] != header || size == 0)
+            {
+                i++;
+                continue;
+            }
+            if (i + 4 + size > buf.size())
+            {
+                break;
+            }
+            type = buf[i + 2];
+            data.assign(buf.begin() + i + 3, buf.begin() + i + 2 + size);
+            buf.erase(buf.begin(), buf.begin() + i + 4 + size);
+            return true;
+        }
+        buf.erase(buf.begin(), buf.begin() + i);
+        return false;
+    }
+};
+
+void footprint()
+{
+    printf("== RAM footprint (static objects, AVR sizes may differ by pointer width)\n");
+    printf("SerialHandler          %5zu bytes\n", sizeof(SerialHandler));
+    printf("LoopMonitor            %5zu bytes\n", sizeof(LoopMonitor));
+    printf("uplink queue           %5zu bytes (%d x %zu)\n", UPLINK_QUEUE_SIZE * sizeof(Uplink), UPLINK_QUEUE_SIZE, sizeof(Uplink));
+    printf("LoopStatsFrame         %5zu bytes\n", sizeof(LoopStatsFrame));
+    printf("HealthFrame            %5zu bytes\n", sizeof(HealthFrame));
+}
+
+void parseCost(const char *name, const std::vector<uint8_t> &stream, unsigned rounds)
+{
+    SerialHandler handler{};
+    handler.begin(SERIAL_BAUD);
+    unsigned long frames{0};
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned round = 0; round < rounds; round++)
+    {
+        size_t pos{0};
+        while (pos < stream.size() || Serial.available() > 0)
+        {
+            pos += nativeSerialInject(stream.data() + pos, stream.size() - pos);
+            const uint8_t *data{nullptr};
+            uint8_t len{0};
+            if (handler.read(data, len, SERIAL_BYTE_BUDGET) == MSG_UPLINK)
+            {
+                frames++;
+            }
+        }
+        // what is left in the ring buffer
+        for (unsigned pass = 0; pass <= SERIAL_RING_SIZE / SERIAL_BYTE_BUDGET; pass++)
+        {
+            const uint8_t *data{nullptr};
+            uint8_t len{0};
+            if (handler.read(data, len, SERIAL_BYTE_BUDGET) == MSG_UPLINK)
+            {
+                frames++;
+            }
+        }
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    const double bytes = static_cast<double>(stream.size()) * rounds;
+    printf("%-22s %6.2f ns/byte, %lu frames, %u checksum rejects\n", name, elapsed / bytes, frames, handler.rejectedChecksum());
+    nativeSerialTakeTx();
+}
+
+void parser()
+{
+    printf("== serial parser\n");
+    std::vector<uint8_t> valid{};
+    for (int i = 0; i < 1000; i++)
+    {
+        auto f = frame(MSG_UPLINK, std::vector<uint8_t>(UPLINK_MAX_PAYLOAD + 2, static_cast<uint8_t>(i)));
+        valid.insert(valid.end(), f.begin(), f.end());
+    }
+    parseCost("valid uplink frames", valid, 100);
+
+    std::vector<uint8_t> garbage(valid.size());
+    uint32_t lfsr{0xace1u};
+    for (auto &byte : garbage)
+    {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xb400u);
+        byte = static_cast<uint8_t>(lfsr);
+    }
+    parseCost("line noise", garbage, 100);
+}
+
+// The raspi end of the line as console_test runs it: at most window uplinks in flight,
+// a ping every 2 s and the baud rate negotiation. Bytes reach the arduino at line rate,
+// whatever does not fit its RX buffer is lost.
+struct Host
+{
+    static constexpr size_t window{5}; // device_window in console_test/src/main.cpp
+    static constexpr unsigned long ping_interval_us{2000000};
+
+    unsigned long baud{SERIAL_BAUD};
+    bool raw{false}; // MSG_UPLINK_RAW frames as with host_encryption
+    std::vector<uint8_t> line{};
+    size_t line_pos{0};
+    // times in us, 32 bit so they wrap like micros() on the AVR
+    uint32_t last_transfer{0};
+    uint32_t next_ping{0};
+    TxFrames rx{};
+    uint8_t next_id{0};
+    size_t waiting{0};
+    std::vector<uint8_t> in_flight{};
+    size_t in_flight_max{0};
+    unsigned long sent{0}, on_air{0}, done{0}, rejected{0};
+    unsigned long proposed{0}; // rate of a running negotiation, 0 if none
+    bool confirming{false};
+    LoopStatsFrame worst{};
+    HealthFrame health{};
+
+    void send(uint8_t type, const std::vector<uint8_t> &data)
+    {
+        auto f = frame(type, data);
+        line.insert(line.end(), f.begin(), f.end());
+    }
+
+    void transfer(uint32_t now)
+    {
+        const size_t arrived = std::min(line.size() - line_pos, static_cast<size_t>((now - last_transfer) * (baud / 10) / 1000000));
+        if (arrived > 0)
+        {
+            nativeSerialInject(line.data() + line_pos, arrived);
+            line_pos += arrived;
+            last_transfer = now;
+        }
+        if (line_pos == line.size())
+        {
+            line.clear();
+            line_pos = 0;
+            last_transfer = now;
+        }
+    }
+
+    void propose(unsigned long rate)
+    {
+        proposed = rate;
+        send(MSG_BAUD_PROPOSE, {static_cast<uint8_t>(rate), static_cast<uint8_t>(rate >> 8), static_cast<uint8_t>(rate >> 16), static_cast<uint8_t>(rate >> 24)});
+    }
+
+    bool negotiating() const
+    {
+        return proposed != 0;
+    }
+
+    void sendUplinks(uint32_t now)
+    {
+        if (static_cast<int32_t>(now - next_ping) >= 0)
+        {
+            send(MSG_BAUD_CONFIRM, {});
+            next_ping = now + ping_interval_us;
+        }
+        while (!negotiating() && waiting > 0 && in_flight.size() < window)
+        {
+            if (raw)
+            {
+                std::vector<uint8_t> phy_payload{next_id, 0x40};
+                phy_payload.resize(UPLINK_MAX_FRAME + 1, 0x55);
+                send(MSG_UPLINK_RAW, phy_payload);
+            }
+            else
+            {
+                std::vector<uint8_t> payload{next_id, 1};
+                payload.resize(UPLINK_MAX_PAYLOAD + 2, 0x55);
+                send(MSG_UPLINK, payload);
+            }
+            in_flight.push_back(next_id++);
+            in_flight_max = std::max(in_flight_max, in_flight.size());
+            waiting--;
+            sent++;
+        }
+    }
+
+    void receive()
+    {
+        auto out = nativeSerialTakeTx();
+        rx.buf.insert(rx.buf.end(), out.begin(), out.end());
+        uint8_t type{0};
+        std::vector<uint8_t> data{};
+        while (rx.next(type, data))
+        {
+            if (type == MSG_UPLINK_STATUS && data.size() >= 2 && data[1] == UPLINK_SENDING)
+            {
+                on_air++;
+            }
+            else if (type == MSG_UPLINK_STATUS && data.size() >= 2 && data[1] != UPLINK_QUEUED)
+            {
+                auto it = std::find(in_flight.begin(), in_flight.end(), data[0]);
+                if (it != in_flight.end())
+                {
+                    in_flight.erase(it);
+                }
+                if (data[1] == UPLINK_DONE)
+                {
+                    done++;
+                }
+                else
+                {
+                    rejected++;
+                    waiting++;
+                }
+            }
+            else if (type == MSG_BAUD_ACK && negotiating())
+            {
+                // the arduino switched after sending the ack
+                baud = proposed;
+                send(MSG_BAUD_CONFIRM, {});
+                confirming = true;
+            }
+            else if (type == MSG_BAUD_CONFIRM && confirming)
+            {
+                proposed = 0;
+                confirming = false;
+            }
+            else if (type == MSG_LOOP_STATS && data.size() >= sizeof(LoopStatsFrame))
+            {
+                LoopStatsFrame stats{};
+                memcpy(&stats, data.data(), sizeof(stats));
+                worst.loop_max_us = std::max(worst.loop_max_us, stats.loop_max_us);
+                worst.loop_avg_us = std::max(worst.loop_avg_us, stats.loop_avg_us);
+                worst.loops += stats.loops;
+                worst.deferred += stats.deferred;
+                worst.rx_late_max_us = std::max(worst.rx_late_max_us, stats.rx_late_max_us);
+                worst.job_late_max_us = std::max(worst.job_late_max_us, stats.job_late_max_us);
+                worst.rx_windows += stats.rx_windows;
+                worst.rx_missed += stats.rx_missed;
+            }
+            else if (type == MSG_HEALTH && data.size() >= sizeof(HealthFrame))
+            {
+                memcpy(&health, data.data(), sizeof(health));
+            }
+        }
+    }
+
+    void resetStats()
+    {
+        sent = on_air = done = rejected = 0;
+        in_flight_max = in_flight.size();
+        worst = LoopStatsFrame{};
+    }
+};
+
+// runs setup() and loop() from main.cpp against the host until simulated_us passed
+void eventPath(Host &host, unsigned long simulated_us, unsigned long uplink_interval_us)
+{
+    const unsigned long lost_before = nativeSerialOverruns();
+    const unsigned long tx_before = nativeTxCount();
+    host.resetStats();
+    // longest a single pass of loop() waited for room in the serial TX buffer
+    unsigned long blocked_max{0};
+    const uint32_t start = micros();
+    uint32_t next_uplink = start;
+    host.last_transfer = start;
+
+    while (static_cast<uint32_t>(micros() - start) < simulated_us)
+    {
+        uint32_t now = micros();
+        if (static_cast<int32_t>(now - next_uplink) >= 0)
+        {
+            host.waiting++;
+            next_uplink += uplink_interval_us;
+        }
+        host.sendUplinks(now);
+        host.transfer(now);
+
+        const unsigned long blocked_before = nativeSerialTxBlocked();
+        loop();
+        blocked_max = std::max(blocked_max, nativeSerialTxBlocked() - blocked_before);
+
+        host.receive();
+
+        // idle: skip ahead to whatever happens next instead of spinning in real time
+        ostime_t deadline{0};
+        if (host.line.empty() && Serial.available() == 0 && nativeSerialTxPending() == 0 && !nativeJobRunnable())
+        {
+            now = micros();
+            uint32_t skip = std::min(next_uplink - now, host.next_ping - now);
+            if (nativeNextDeadline(deadline))
+            {
+                const long until_job = osticks2us(deadline - os_getTime());
+                if (until_job < static_cast<int32_t>(skip))
+                {
+                    skip = until_job > 0 ? until_job : 0;
+                }
+            }
+            if (static_cast<int32_t>(skip) > 0 && skip <= simulated_us)
+            {
+                nativeAdvance(skip);
+                host.last_transfer += skip;
+                loop_monitor->resume();
+            }
+        }
+    }
+
+    const LoopStatsFrame &worst = host.worst;
+    printf("uplinks sent %lu, on air %lu, done %lu, rejected %lu, radio tx %lu, in flight max %zu, serial bytes lost %lu\n", host.sent, host.on_air, host.done, host.rejected, nativeTxCount() - tx_before, host.in_flight_max, nativeSerialOverruns() - lost_before);
+    printf("loop max %u us, worst interval avg %u us over %u passes, %u deferred\n", worst.loop_max_us, worst.loop_avg_us, worst.loops, worst.deferred);
+    printf("rx windows %u, missed %u, rx late max %u us, any job late max %u us, serial tx blocked max %lu us per pass\n", worst.rx_windows, worst.rx_missed, worst.rx_late_max_us, worst.job_late_max_us, blocked_max);
+    printf("queue depth %u, rejected overflow %u, checksum %u, rx high water %u, ring high water %u\n", host.health.queue_depth, host.health.rejected_overflow, host.health.rejected_checksum, host.health.serial_rx_high_water, host.health.serial_ring_high_water);
+}
+
+void eventPaths()
+{
+    constexpr unsigned long simulated_us{30ul * 60 * 1000000};
+    constexpr unsigned long uplink_interval_us{5ul * 1000000};
+    constexpr unsigned long fast_baud{1000000};
+
+    setup();
+    Host host{};
+    printf("== event path at %lu baud, %lu s simulated, one uplink every %lu s, window %zu\n", host.baud, simulated_us / 1000000, uplink_interval_us / 1000000, Host::window);
+    eventPath(host, simulated_us, uplink_interval_us);
+
+    host.propose(fast_baud);
+    printf("== event path at %lu baud after negotiating, %lu s simulated, one uplink every %lu s, window %zu\n", fast_baud, simulated_us / 1000000, uplink_interval_us / 1000000, Host::window);
+    eventPath(host, simulated_us, uplink_interval_us);
+
+    // long enough for the raw frames to get past what the arduino still holds, each waits out
+    // the band; micros() - start limits a run to the 71 minutes of a 32 bit micros()
+    constexpr unsigned long raw_simulated_us{60ul * 60 * 1000000};
+    host.raw = true;
+    host.waiting = 0;
+    printf("== event path with raw frames at %lu baud, %lu s simulated, one uplink every %lu s, window %zu\n", fast_baud, raw_simulated_us / 1000000, uplink_interval_us / 1000000, Host::window);
+    eventPath(host, raw_simulated_us, uplink_interval_us);
+    printf("link at %lu baud on the raspi, %lu on the arduino, %s\n", host.baud, nativeSerialBaud(), host.negotiating() ? "negotiation did not finish" : "negotiated");
+    printf("String heap now %zu bytes, peak %zu bytes, %lu allocations\n", nativeHeapCurrent(), nativeHeapPeak(), nativeHeapAllocations());
+}
+} // namespace
+
+int main()
+{
+    footprint();
+    parser();
+    eventPaths();
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <lmic.h>
+#include "native_shim.h"
+
+#include <cmath>
+
+struct lmic_t LMIC{};
+
+namespace
+{
+osjob_t *scheduled_jobs{nullptr};
+osjob_t *runnable_jobs{nullptr};
+lmic_event_cb_t *event_cb{nullptr};
+void *event_user_data{nullptr};
+ostime_t band_free{0};
+unsigned long tx_count{0};
+
+// LMIC starts the receiver this early to catch the preamble
+constexpr ostime_t rx_rampup{us2osticks(2000)};
+constexpr ostime_t rx_window{ms2osticks(300)};
+
+void unlink(osjob_t *job)
+{
+    for (osjob_t **pnext = &scheduled_jobs; *pnext != nullptr; pnext = &(*pnext)->next)
+    {
+        if (*pnext == job)
+        {
+            *pnext = job->next;
+            break;
+        }
+    }
+    for (osjob_t **pnext = &runnable_jobs; *pnext != nullptr; pnext = &(*pnext)->next)
+    {
+        if (*pnext == job)
+        {
+            *pnext = job->next;
+            break;
+        }
+    }
+    job->next = nullptr;
+}
+
+void report(ev_t ev)
+{
+    if (event_cb != nullptr)
+    {
+        event_cb(event_user_data, ev);
+    }
+}
+
+// LoRa time on air at 125 kHz, CR 4/5, 8 symbol preamble, explicit header and CRC
+ostime_t airtime(dr_t dr, u1_t frame_len)
+{
+    const int sf = (dr <= DR_SF7) ? 12 - dr : 7;
+    const double bandwidth = (dr == DR_SF7B) ? 250e3 : 125e3;
+    const double symbol = std::pow(2.0, sf) / bandwidth;
+    const int low_dr_optimize = (sf >= 11) ? 1 : 0;
+    const double payload_symbols = 8 + std::fmax(std::ceil((8.0 * frame_len - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * low_dr_optimize))) * 5, 0);
+    return us2osticks((12.25 + payload_symbols) * symbol * 1e6);
+}
+
+void txDone(osjob_t *job)
+{
+    LMIC.opmode &= ~(OP_TXRXPEND | OP_TXDATA);
+    LMIC.txrxFlags = 0;
+    LMIC.dataLen = 0;
+    LMIC.seqnoUp++;
+    report(EV_TXCOMPLETE);
+}
+
+void rxStart(osjob_t *job, u1_t window, ostime_t next_rxtime, osjobcb_t next)
+{
+    LMIC.txrxFlags = window;
+    LMIC.dataLen = 0;
+    report(EV_RXSTART);
+    LMIC.rxtime = next_rxtime;
+    os_setTimedCallback(&LMIC.osjob, next_rxtime - rx_rampup, next);
+}
+
+void rx2(osjob_t *job)
+{
+    // nothing ever arrives, the transaction ends with the RX2 window
+    rxStart(job, TXRX_DNW2, LMIC.rxtime + rx_window, txDone);
+}
+
+void rx1(osjob_t *job)
+{
+    rxStart(job, TXRX_DNW1, LMIC.txend + sec2osticks(2), rx2);
+}
+
+void txStart(osjob_t *job)
+{
+    // 13 bytes of MHDR, FHDR, FPort and MIC around the payload
+    const u1_t frame_len = LMIC.pendTxLen + 13;
+    // only now the MAC is busy with the radio, before it waited for the band
+    LMIC.opmode |= OP_TXRXPEND;
+    report(EV_TXSTART);
+    tx_count++;
+    LMIC.txend = os_getTime() + airtime(LMIC.datarate, frame_len);
+    // 1% duty cycle in the g-band
+    band_free = LMIC.txend + 99 * (LMIC.txend - os_getTime());
+    LMIC.rxtime = LMIC.txend + sec2osticks(1);
+    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - rx_rampup, rx1);
+}
+} // namespace
+
+void os_init(void)
+{
+    scheduled_jobs = nullptr;
+    runnable_jobs = nullptr;
+}
+
+ostime_t os_getTime(void)
+{
+    // micros() wraps after 71 minutes, the HAL extends it as hal_ticks() does
+    static uint32_t last_micros{0};
+    static uint64_t wraps{0};
+    const uint32_t now = micros();
+    if (now < last_micros)
+    {
+        wraps += uint64_t{1} << 32;
+    }
+    last_micros = now;
+    return static_cast<ostime_t>((wraps + now) / US_PER_OSTICK);
+}
+
+void os_setCallback(osjob_t *job, osjobcb_t cb)
+{
+    unlink(job);
+    job->func = cb;
+    osjob_t **pnext = &runnable_jobs;
+    while (*pnext != nullptr)
+    {
+        pnext = &(*pnext)->next;
+    }
+    *pnext = job;
+}
+
+void os_setTimedCallback(osjob_t *job, ostime_t time, osjobcb_t cb)
+{
+    unlink(job);
+    job->func = cb;
+    job->deadline = time;
+    osjob_t **pnext = &scheduled_jobs;
+    while (*pnext != nullptr && (*pnext)->deadline - time <= 0)
+    {
+        pnext = &(*pnext)->next;
+    }
+    job->next = *pnext;
+    *pnext = job;
+}
+
+void os_clearCallback(osjob_t *job)
+{
+    unlink(job);
+}
+
+void os_runloop_once(void)
+{
+    osjob_t *job{nullptr};
+    if (runnable_jobs != nullptr)
+    {
+        job = runnable_jobs;
+        runnable_jobs = job->next;
+    }
+    else if (scheduled_jobs != nullptr && os_getTime() - scheduled_jobs->deadline >= 0)
+    {
+        job = scheduled_jobs;
+        scheduled_jobs = job->next;
+    }
+    if (job != nullptr)
+    {
+        job->next = nullptr;
+        job->func(job);
+    }
+}
+
+bit_t os_queryTimeCriticalJobs(ostime_t time)
+{
+    return scheduled_jobs != nullptr && scheduled_jobs->deadline - os_getTime() < time;
+}
+
+ostime_t os_getNextDeadline(bit_t *valid)
+{
+    *valid = scheduled_jobs != nullptr;
+    return *valid ? scheduled_jobs->deadline : os_getTime();
+}
+
+void LMIC_reset(void)
+{
+    const u4_t seqno = LMIC.seqnoUp;
+    LMIC = lmic_t{};
+    LMIC.seqnoUp = seqno;
+    band_free = os_getTime();
+}
+
+void LMIC_setSession(u4_t netid, devaddr_t devaddr, const u1_t *nwkKey, const u1_t *artKey)
+{
+}
+
+bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t band)
+{
+    if (channel >= MAX_CHANNELS)
+    {
+        return 0;
+    }
+    LMIC.channelFreq[channel] = freq | band;
+    return 1;
+}
+
+void LMIC_setLinkCheckMode(bit_t enabled)
+{
+}
+
+void LMIC_setDrTxpow(dr_t dr, s1_t txpow)
+{
+    LMIC.datarate = dr;
+}
+
+void LMIC_setAdrMode(bit_t enabled)
+{
+}
+
+void LMIC_setClockError(u2_t error)
+{
+}
+
+int LMIC_registerEventCb(lmic_event_cb_t *pEventCb, void *pUserData)
+{
+    event_cb = pEventCb;
+    event_user_data = pUserData;
+    return 1;
+}
+
+lmic_tx_error_t LMIC_setTxData2(u1_t port, const u1_t *data, u1_t dlen, u1_t confirmed)
+{
+    // one pending uplink at a time, from here until EV_TXCOMPLETE
+    if (LMIC.opmode & (OP_TXDATA | OP_TXRXPEND))
+    {
+        return LMIC_ERROR_TX_BUSY;
+    }
+    if (dlen > sizeof(LMIC.pendTxData))
+    {
+        return LMIC_ERROR_TX_TOO_LARGE;
+    }
+    memcpy(LMIC.pendTxData, data, dlen);
+    LMIC.pendTxLen = dlen;
+    LMIC.pendTxPort = port;
+    // OP_TXRXPEND follows when the duty cycle allows the TX, see txStart()
+    LMIC.opmode |= OP_TXDATA;
+    const ostime_t now = os_getTime();
+    os_setTimedCallback(&LMIC.osjob, (band_free - now > 0) ? band_free : now, txStart);
+    return LMIC_ERROR_SUCCESS;
+}
+
+void os_radio(u1_t mode)
+{
+    if (mode != RADIO_TX)
+    {
+        return;
+    }
+    tx_count++;
+    LMIC.txend = os_getTime() + calcAirTime(LMIC.rps, LMIC.dataLen);
+    // the TX done interrupt schedules whatever the caller put into LMIC.osjob.func
+    os_setTimedCallback(&LMIC.osjob, LMIC.txend, LMIC.osjob.func);
+}
+
+ostime_t calcAirTime(rps_t rps, u1_t plen)
+{
+    return airtime(static_cast<dr_t>(rps), plen);
+}
+
+// ======================================================================================
+
+bool nativeNextDeadline(ostime_t &deadline)
+{
+    if (scheduled_jobs == nullptr)
+    {
+        return false;
+    }
+    deadline = scheduled_jobs->deadline;
+    return true;
+}
+
+bool nativeJobRunnable()
+{
+    return runnable_jobs != nullptr;
+}
+
+unsigned long nativeTxCount()
+{
+    return tx_count;
+}
@@ -0,0 +1,99 @@
+/*
+ * Device health telemetry. The SRAM figures walk avr-libc's heap bookkeeping:
+ * free memory is the gap between the heap top (__brkval) and the stack plus
+ * whatever sits in the malloc free list (__flp). A fragmented heap shows up as
+ * a largest block well below the free total.
+ */
+#include "health.h"
+#include "serialhandler.h"
+#include "muonpi_lmic.h"
+#include <Arduino.h>
+#include <stdint.h>
+#include <lmic.h>
+
+#ifdef __AVR__
+struct __freelist
+{
+    size_t sz;
+    struct __freelist *nx;
+};
+
+extern "C"
+{
+    extern char *__brkval;
+    extern char __heap_start;
+    extern size_t __malloc_margin;
+    extern struct __freelist *__flp;
+}
+
+static uint16_t stackGap()
+{
+    char top;
+    const char *heap_end = (__brkval != nullptr) ? __brkval : &__heap_start;
+    return static_cast<uint16_t>(&top - heap_end);
+}
+#endif
+
+uint16_t freeSram()
+{
+#ifdef __AVR__
+    uint16_t free = stackGap();
+    for (struct __freelist *block = __flp; block != nullptr; block = block->nx)
+    {
+        free += block->sz + sizeof(size_t);
+    }
+    return free;
+#else
+    return 0;
+#endif
+}
+
+uint16_t largestFreeBlock()
+{
+#ifdef __AVR__
+    // new allocations from the top of the heap have to leave __malloc_margin for the stack
+    const uint16_t gap = stackGap();
+    uint16_t largest = (gap > __malloc_margin) ? gap - __malloc_margin : 0;
+    for (struct __freelist *block = __flp; block != nullptr; block = block->nx)
+    {
+        if (block->sz > largest)
+        {
+            largest = block->sz;
+        }
+    }
+    return largest;
+#else
+    return 0;
+#endif
+}
+
+// millis() wraps after 49.7 days, the raspi asks for health often enough to see every wrap
+uint32_t uptimeSeconds()
+{
+    static uint32_t last_ms{0};
+    static uint16_t wraps{0};
+    const uint32_t ms = millis();
+    if (ms < last_ms)
+    {
+        wraps++;
+    }
+    last_ms = ms;
+    return wraps * 4294967ul + ms / 1000;
+}
+
+void reportHealth(SerialHandler *serial_handler, const MuonPiLMIC *lmic)
+{
+    HealthFrame frame{};
+    frame.free_sram = freeSram();
+    frame.largest_block = largestFreeBlock();
+    frame.serial_rx_high_water = serial_handler->rxHighWater();
+    frame.queue_depth = lmic->queueDepth();
+    frame.opmode = LMIC.opmode;
+    frame.datarate = LMIC.datarate;
+    frame.seqno_up = LMIC.seqnoUp;
+    frame.rejected_checksum = serial_handler->rejectedChecksum();
+    frame.rejected_overflow = lmic->rejectedOverflow();
+    frame.serial_ring_high_water = serial_handler->ringHighWater();
+    frame.uptime_s = uptimeSeconds();
+    serial_handler->send(MSG_HEALTH, reinterpret_cast<const uint8_t *>(&frame), sizeof(frame));
+}
@@ -0,0 +1,72 @@
+/*
+ * Loop jitter instrumentation. tick() and jobDue() run once per pass of loop(), rxStart() from the
+ * EV_RXSTART event which LMIC reports from inside the job that opens the RX window.
+ * Nothing in here may print, rxStart() runs while the radio timing is critical.
+ */
+#include "loopmonitor.h"
+#include "serialhandler.h"
+#include <Arduino.h>
+#include <stdint.h>
+#include <lmic.h>
+
+void LoopMonitor::tick()
+{
+    const unsigned long now = micros();
+    if (m_started)
+    {
+        const uint32_t elapsed = now - m_last_tick;
+        if (elapsed > m_stats.loop_max_us)
+        {
+            m_stats.loop_max_us = elapsed;
+        }
+        m_loop_sum += elapsed;
+        m_stats.loops++;
+    }
+    m_started = true;
+    m_last_tick = now;
+}
+
+// call after the loop was suspended on purpose, e.g. sleeping, so the pause is not counted
+void LoopMonitor::resume()
+{
+    m_started = false;
+}
+
+void LoopMonitor::deferred()
+{
+    m_stats.deferred++;
+}
+
+void LoopMonitor::rxStart()
+{
+    const ostime_t now = os_getTime();
+    // LMIC.osjob is the job opening the window, its deadline is when it was due
+    const ostime_t late = now - LMIC.osjob.deadline;
+    if (late > 0 && static_cast<uint32_t>(osticks2us(late)) > m_stats.rx_late_max_us)
+    {
+        m_stats.rx_late_max_us = osticks2us(late);
+    }
+    m_stats.rx_windows++;
+    if (now - LMIC.rxtime > 0)
+    {
+        m_stats.rx_missed++;
+    }
+}
+
+// call before os_runloop_once() with the deadline of the next timed job
+void LoopMonitor::jobDue(ostime_t deadline)
+{
+    const ostime_t late = os_getTime() - deadline;
+    if (late >= 0 && static_cast<uint32_t>(osticks2us(late)) > m_stats.job_late_max_us)
+    {
+        m_stats.job_late_max_us = osticks2us(late);
+    }
+}
+
+void LoopMonitor::report(SerialHandler *serial_handler)
+{
+    m_stats.loop_avg_us = (m_stats.loops > 0) ? m_loop_sum / m_stats.loops : 0;
+    serial_handler->send(MSG_LOOP_STATS, reinterpret_cast<const uint8_t *>(&m_stats), sizeof(m_stats));
+    m_stats = LoopStatsFrame{};
+    m_loop_sum = 0;
+}
@@ -18,6 +18,8 @@
 #include "main.h"
 #include "muonpi_lmic.h"
 #include "serialhandler.h"
+#include "loopmonitor.h"
+#include "health.h"
 #include <Arduino.h>
 
 // TTN *****************************
@@ -37,6 +39,7 @@ static const u4_t DEVADDR = 0x260BC37E;
 /********************************/
 
 osjob_t workjob;
+osjob_t statsjob;
 
 // void(* resetFunc) (void) = 0;  //declare reset function at address 0
 
@@ -48,9 +51,9 @@ MuonPiLMIC *muonpi_lmic;
 
 SerialHandler *serial_handler;
 
-unsigned count{0};
+LoopMonitor *loop_monitor;
 
-String str{""};
+unsigned count{0};
 
 // ============================================================================
 
@@ -63,20 +66,27 @@ String str{""};
 //     os_setTimedCallback(&workjob, os_getTime() + sec2osticks(TX_INTERVAL), process_work);
 // }
 
+void report_stats(osjob_t *job)
+{
+    loop_monitor->report(serial_handler);
+    reportHealth(serial_handler, muonpi_lmic);
+    os_setTimedCallback(&statsjob, os_getTime() + sec2osticks(STATS_INTERVAL), report_stats);
+}
+
 void setup()
 {
+    serial_handler = new SerialHandler();
+    loop_monitor = new LoopMonitor();
+    // safe rate the link starts and falls back to, the raspi may negotiate a higher one
 #ifndef SERIAL_BAUD
-    Serial.begin(9600, SERIAL_8N1);
+    serial_handler->begin(DEFAULT_BAUD);
 #else
-    Serial.begin(SERIAL_BAUD, SERIAL_8N1);
+    serial_handler->begin(SERIAL_BAUD);
 #endif
     Serial.flush();
-    // str.reserve(255);
     while (!Serial)
         delay(10);
 
-    serial_handler = new SerialHandler();
-
     // Create the LMIC object
     muonpi_lmic = new MuonPiLMIC();
 
@@ -88,26 +98,53 @@ void setup()
     memcpy_P(nwkskey, NWKSKEY, sizeof(NWKSKEY));
 
     // Setup LMIC
-    muonpi_lmic->setup(DEVADDR, appskey, nwkskey, serial_handler);
+    muonpi_lmic->setup(DEVADDR, appskey, nwkskey, serial_handler, loop_monitor);
 
     // process_work(&workjob);
+    os_setTimedCallback(&statsjob, os_getTime() + sec2osticks(STATS_INTERVAL), report_stats);
 }
 
 // ============================================================================
 
 void loop()
 {
-    auto data_avail = serial_handler->read(str);
-    if (data_avail)
+    loop_monitor->tick();
+    // always drained, only parsing and dispatching wait for LMIC
+    serial_handler->pump();
+    // LMIC jobs close to their deadline run first, serial parsing only gets the slack
+    if (os_queryTimeCriticalJobs(ms2osticks(LMIC_JOB_SLACK_MS)))
+    {
+        loop_monitor->deferred();
+    }
+    else
+    {
+        const uint8_t *data{nullptr};
+        uint8_t len{0};
+        switch (serial_handler->read(data, len, SERIAL_BYTE_BUDGET))
+        {
+        case MSG_UPLINK:
+            if (len > 1)
+                muonpi_lmic->sendLoraPayload(data[1], data[0], data + 2, len - 2);
+            break;
+        case MSG_UPLINK_RAW:
+            if (len > 0)
+                muonpi_lmic->sendRawFrame(data[0], data + 1, len - 1);
+            break;
+        case MSG_LOOP_STATS_REQ:
+            loop_monitor->report(serial_handler);
+            break;
+        case MSG_HEALTH_REQ:
+            reportHealth(serial_handler, muonpi_lmic);
+            break;
+        default:
+            break;
+        }
+    }
+    bit_t job_scheduled{0};
+    const ostime_t deadline = os_getNextDeadline(&job_scheduled);
+    if (job_scheduled)
     {
-        // if (str.c_str() == "reset"){
-        //     serial_handler->send("reset was received");
-        //     delay(2000);
-        //     resetFunc();
-        // }
-        char *arr = str.c_str();
-        muonpi_lmic->sendLoraPayload(1u, reinterpret_cast<uint8_t *>(arr));
-        str = "";
+        loop_monitor->jobDue(deadline);
     }
     os_runloop_once();
 }
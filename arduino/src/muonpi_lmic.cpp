@@ -41,6 +41,9 @@
 #include <hal/hal.h>
 // #include <SPI.h>
 
+static_assert(2 + UPLINK_MAX_FRAME <= MAX_INBOUND_PAYLOAD, "MSG_UPLINK_RAW does not fit the serial frame buffer");
+static_assert(3 + UPLINK_MAX_PAYLOAD <= MAX_INBOUND_PAYLOAD, "MSG_UPLINK does not fit the serial frame buffer");
+
 bool joined = false;
 bool sleeping = false;
 
@@ -49,7 +52,17 @@ static osjob_t sendjob;
 
 uint32_t uplinkSequenceNo = 0; // aka FCnt
 
-String MuonPiLMIC::data{};
+Uplink MuonPiLMIC::m_queue[UPLINK_QUEUE_SIZE]{};
+uint8_t MuonPiLMIC::m_queue_head{0};
+uint8_t MuonPiLMIC::m_queue_count{0};
+uint16_t MuonPiLMIC::m_rejected_overflow{0};
+uint8_t MuonPiLMIC::m_tx_id{0};
+bool MuonPiLMIC::m_tx_active{false};
+ostime_t MuonPiLMIC::m_raw_band_free{0};
+uint8_t MuonPiLMIC::m_raw_channel{0};
+
+// raw frames hop over the LoRa channels 0 to 7 from setup(), channel 8 is FSK
+#define RAW_CHANNEL_COUNT 8
 
 // arduino lmic pin mapping
 const lmic_pinmap lmic_pins = {
@@ -65,10 +78,32 @@ const lmic_pinmap lmic_pins = {
 // ======================================================================================
 
 SerialHandler *MuonPiLMIC::m_serial_handler{nullptr};
+LoopMonitor *MuonPiLMIC::m_loop_monitor{nullptr};
 
 void printEvent(ev_t ev){
 
 }
+
+#ifdef LOG_TX_FRAME
+#include <stdio.h>
+
+// The frame LMIC is about to send, a known answer for console_test/test/test_lorawan.cpp.
+// Costs a 150 byte buffer on the stack, only built into the capture_frames environment.
+static void logTxFrame(SerialHandler *serial_handler)
+{
+    static const char digits[] = "0123456789abcdef";
+    char line[24 + 2 * UPLINK_MAX_FRAME + 1];
+    int pos = snprintf(line, 24, "fcnt %lu frame ", static_cast<unsigned long>(LMIC.seqnoUp));
+    const uint8_t len = LMIC.dataLen < UPLINK_MAX_FRAME ? LMIC.dataLen : UPLINK_MAX_FRAME;
+    for (uint8_t i = 0; i < len; i++)
+    {
+        line[pos++] = digits[LMIC.frame[i] >> 4];
+        line[pos++] = digits[LMIC.frame[i] & 0x0f];
+    }
+    line[pos] = '\0';
+    serial_handler->send(line);
+}
+#endif
 // =========================================================================================================================================
 // onEvent
 // =========================================================================================================================================
@@ -79,15 +114,27 @@ void MuonPiLMIC::onEvent(void *pUserData, ev_t ev)
     {
     case EV_RXSTART:
         // Do not print anything for this event or it will mess up timing.
+        if (m_loop_monitor != nullptr)
+            m_loop_monitor->rxStart();
         break;
 
     case EV_TXSTART:
-        m_serial_handler->send(String(os_getTime() + String(": EV_TXSTART")));
+        if (m_tx_active)
+            sendStatus(m_tx_id, UPLINK_SENDING);
+        m_serial_handler->send(String(os_getTime()) + String(F(": EV_TXSTART")));
+#ifdef LOG_TX_FRAME
+        logTxFrame(m_serial_handler);
+#endif
         break;
     case EV_JOIN_TXCOMPLETE:
         m_serial_handler->send(F("EV_JOIN_TXCOMPLETE"));
     case EV_TXCANCELED:
         m_serial_handler->send(F("EV_TXCANCELLED"));
+        if (m_tx_active)
+        {
+            m_tx_active = false;
+            sendStatus(m_tx_id, UPLINK_REJECTED);
+        }
         break;
     case EV_SCAN_TIMEOUT:
         m_serial_handler->send(F("EV_SCAN_TIMEOUT"));
@@ -123,16 +170,20 @@ void MuonPiLMIC::onEvent(void *pUserData, ev_t ev)
         break;
     case EV_TXCOMPLETE:
         m_serial_handler->send(F("EV_TXCOMPLETE"));
+        if (m_tx_active)
+        {
+            m_tx_active = false;
+            sendStatus(m_tx_id, UPLINK_DONE);
+        }
         if (LMIC.txrxFlags & TXRX_ACK)
             m_serial_handler->send(F("Received ack"));
         if (LMIC.dataLen)
         {
-            m_serial_handler->send(F("Received "));
-            m_serial_handler->send(LMIC.dataLen);
-            m_serial_handler->send(F(" bytes of payload"));
+            m_serial_handler->send(String(F("Received ")) + String(LMIC.dataLen) + String(F(" bytes of payload")));
         }
         // Schedule next transmission
-        // will be called by main loop
+        if (m_queue_count > 0)
+            os_setCallback(&sendjob, do_send);
         break;
     case EV_LOST_TSYNC:
         m_serial_handler->send(F("EV_LOST_TSYNC\n"));
@@ -167,9 +218,10 @@ void MuonPiLMIC::onEvent(void *pUserData, ev_t ev)
 
 // ======================================================================================
 
-bool MuonPiLMIC::setup(devaddr_t devaddr, unsigned char *appskey, unsigned char *nwkskey, SerialHandler *f_serial_handler)
+bool MuonPiLMIC::setup(devaddr_t devaddr, unsigned char *appskey, unsigned char *nwkskey, SerialHandler *f_serial_handler, LoopMonitor *f_loop_monitor)
 {
     m_serial_handler = f_serial_handler;
+    m_loop_monitor = f_loop_monitor;
     os_init(); // LMIC init
 
     m_serial_handler->send(F("Starting"));
@@ -211,26 +263,131 @@ bool MuonPiLMIC::setup(devaddr_t devaddr, unsigned char *appskey, unsigned char
 
 void MuonPiLMIC::do_send(osjob_t *workjob)
 {
-    // Check if there is not a current TX/RX job running
-    if (LMIC.opmode & OP_TXRXPEND)
+    // Check if there is not a current TX/RX job running, or one waiting for the duty cycle
+    if ((LMIC.opmode & (OP_TXDATA | OP_TXRXPEND)) || m_tx_active)
     {
-        m_serial_handler->send(F("OP_TXRXPEND, not sending"));
+        // stays queued, EV_TXCOMPLETE or rawTxDone() schedules the next attempt
         return;
     }
+    if (m_queue_count == 0)
+    {
+        return;
+    }
+    Uplink &uplink = m_queue[m_queue_head];
+    if (uplink.raw)
+    {
+        // Out of the queue right away, the frame waits for the band in LMIC.frame and is
+        // the one in flight, like an uplink LMIC holds through its own duty cycle wait.
+        // The raspi's window counts on that: UPLINK_QUEUE_SIZE queued plus one in flight.
+        memcpy(LMIC.frame, uplink.data, uplink.len);
+        LMIC.dataLen = uplink.len;
+        m_tx_id = uplink.id;
+        m_tx_active = true;
+        // LMIC keeps the duty cycle only for its own frames, wait for the band here
+        const ostime_t now = os_getTime();
+        os_setTimedCallback(&sendjob, (m_raw_band_free - now > 0) ? m_raw_band_free : now, rawTxStart);
+    }
     else
     {
+        uplinkSequenceNo = uplinkSequenceNo + 1;
+        LMIC.seqnoUp = uplinkSequenceNo;
+
         // Prepare upstream data transmission at the next possible time.
-        LMIC_setTxData2(1, data.c_str(), sizeof(data) - 1, 0);
-        m_serial_handler->send("Packed queued: " + data);
+        // LMIC copies the payload, so the slot is free again right away.
+        if (LMIC_setTxData2(uplink.port, uplink.data, uplink.len, 0) == 0)
+        {
+            m_tx_id = uplink.id;
+            m_tx_active = true;
+            m_serial_handler->send(F("Packet queued"));
+        }
+        else
+        {
+            sendStatus(uplink.id, UPLINK_REJECTED);
+        }
     }
+    m_queue_head = (m_queue_head + 1) % UPLINK_QUEUE_SIZE;
+    m_queue_count--;
     // Next TX is scheduled after TX_COMPLETE event.
 }
 
-void MuonPiLMIC::sendLoraPayload(uint8_t port, String &message)
+void MuonPiLMIC::rawTxStart(osjob_t *job)
+{
+    // The raspi built and encrypted the frame and counts FCnt, LMIC's MAC is idle
+    // (no OP_TXDATA or OP_TXRXPEND), so its job and frame buffer are free for a plain
+    // radio TX. do_send() put the frame into LMIC.frame already.
+    LMIC.freq = LMIC.channelFreq[m_raw_channel] & ~(u4_t)3; // the low bits hold the band
+    m_raw_channel = (m_raw_channel + 1) % RAW_CHANNEL_COUNT;
+    LMIC.rps = updr2rps(LMIC.datarate);
+    // configPower() in the radio driver reads radio_txpow, LMIC.txpow is only the MAC's setting
+    LMIC.radio_txpow = RAW_TX_POWER;
+    LMIC.osjob.func = rawTxDone;
+    os_radio(RADIO_TX);
+    sendStatus(m_tx_id, UPLINK_SENDING);
+    // 1% duty cycle in the g-band
+    m_raw_band_free = os_getTime() + 100 * calcAirTime(LMIC.rps, LMIC.dataLen);
+}
+
+void MuonPiLMIC::rawTxDone(osjob_t *job)
 {
-    data = message;
-    uplinkSequenceNo = uplinkSequenceNo + 1;
-    LMIC.seqnoUp = uplinkSequenceNo;
+    // no receive windows, a raw frame is unconfirmed and ABP needs no downlink
+    m_tx_active = false;
+    sendStatus(m_tx_id, UPLINK_DONE);
+    if (m_queue_count > 0)
+        os_setCallback(&sendjob, do_send);
+}
+
+bool MuonPiLMIC::sendLoraPayload(uint8_t port, uint8_t id, const uint8_t *data, uint8_t len)
+{
+    if (port < UPLINK_MIN_PORT || port > UPLINK_MAX_PORT)
+    {
+        sendStatus(id, UPLINK_REJECTED);
+        return false;
+    }
+    return enqueue(id, false, port, data, len, UPLINK_MAX_PAYLOAD);
+}
+
+bool MuonPiLMIC::sendRawFrame(uint8_t id, const uint8_t *frame, uint8_t len)
+{
+    // the port is part of the frame
+    return enqueue(id, true, 0, frame, len, UPLINK_MAX_FRAME);
+}
+
+bool MuonPiLMIC::enqueue(uint8_t id, bool raw, uint8_t port, const uint8_t *data, uint8_t len, uint8_t max_len)
+{
+    if (m_queue_count >= UPLINK_QUEUE_SIZE || len > max_len)
+    {
+        m_rejected_overflow++;
+        sendStatus(id, UPLINK_REJECTED);
+        return false;
+    }
+    Uplink &uplink = m_queue[(m_queue_head + m_queue_count) % UPLINK_QUEUE_SIZE];
+    uplink.id = id;
+    uplink.raw = raw;
+    uplink.port = port;
+    memcpy(uplink.data, data, len);
+    uplink.len = len;
+    m_queue_count++;
+    sendStatus(id, UPLINK_QUEUED);
 
-    os_setCallback(&sendjob, do_send);
+    if (!(LMIC.opmode & (OP_TXDATA | OP_TXRXPEND)) && !m_tx_active)
+    {
+        os_setCallback(&sendjob, do_send);
+    }
+    return true;
+}
+
+void MuonPiLMIC::sendStatus(uint8_t id, UplinkStatus status)
+{
+    const uint8_t frame[2]{id, status};
+    m_serial_handler->send(MSG_UPLINK_STATUS, frame, sizeof(frame));
+}
+
+uint8_t MuonPiLMIC::queueDepth() const
+{
+    return m_queue_count;
+}
+
+uint16_t MuonPiLMIC::rejectedOverflow() const
+{
+    return m_rejected_overflow;
 }
\ No newline at end of file
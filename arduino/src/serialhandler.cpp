@@ -1,16 +1,27 @@
 /*
- *  Baud rate = 9600Hz
- * Baud lenght= 1/9600=104µs
+ * Link starts at SERIAL_BAUD and can be raised at runtime, see handleControl().
+ * At 16 MHz with U2X the rates 250k, 500k and 1M are exact, 115200 is off by 2.1%.
  *
- * ASIC reads on rising clock edge
+ * frame: <header> <size> <type> <data...> <chkA> <chkB>
+ * size counts type and data, so a frame is size + 4 bytes long, size <= MAX_FRAME_PAYLOAD.
+ * The parser takes sizes up to MAX_INBOUND_PAYLOAD, on a larger one it looks for the next header.
+ * pump() moves whatever arrived into a ring buffer, read() parses frames from there byte by
+ * byte and never blocks on a partial frame.
+ * checksum bytes are created from type and data, NOT containing header and size byte
  *
+ * baud rate negotiation (raspi initiates):
+ * raspi -> arduino: MSG_BAUD_PROPOSE <baud>          at the old rate
+ * arduino -> raspi: MSG_BAUD_ACK <baud>              at the old rate, then both switch
+ * raspi -> arduino: MSG_BAUD_CONFIRM                 at the new rate
+ * arduino -> raspi: MSG_BAUD_CONFIRM                 at the new rate, switch is committed
+ * Without the confirm the arduino reverts after BAUD_CONFIRM_TIMEOUT.
  *
- *
- * message Protocol arduino - raspi, every value equals one byte.
- * raspi -> arduino: <header> <multiplexer> <4command_bits+00+data_bit[9]+data_bit[8]> <data_lsb> <chipID> <chkA> <chkB>
- * arduino -> raspi: <header> <multiplexer> <4command_bits+00+data_bit[9]+data_bit[8]> <data_lsb> <chipID> <chkA> <chkB>
- *
- * checksum bytes are created from string NOT containing the header byte
+ * Once committed, the raspi keeps pinging with MSG_BAUD_CONFIRM and the arduino answers it.
+ * A side that hears no valid frame for BAUD_SILENCE_TIMEOUT goes back to the safe rate. A lost
+ * confirm or a glitch that leaves the two sides at different rates silences both directions,
+ * so both end up at the safe rate and the raspi negotiates again.
+ * A link that still carries the pings but corrupts many frames is the raspi's call: on a
+ * burst of framing errors it proposes a slower rate, the safe one included, as above.
  */
 #include "serialhandler.h"
 #include <Arduino.h>
@@ -19,56 +30,164 @@
 #include <hal/hal.h>
 
 const uint8_t MESSAGE_HEADER = 0xf9u;
-constexpr size_t buffer_size = 0xffu;
 
-bool SerialHandler::read(String &str) {
-	while (Serial.available() > 0)
+static void fletcherAdd(uint8_t byte, uint8_t &chkA, uint8_t &chkB)
+{
+	chkA += byte;
+	chkB += chkA;
+}
+
+void SerialHandler::begin(uint32_t safe_baud)
+{
+	m_safe_baud = safe_baud;
+	m_baud = safe_baud;
+	Serial.begin(safe_baud, SERIAL_8N1);
+}
+
+// cheap enough for every pass of loop(), also while an LMIC job is about to run
+void SerialHandler::pump() {
+	const int available = Serial.available();
+	if (available > m_rx_high_water) {
+		m_rx_high_water = static_cast<uint8_t>(available);
+	}
+	// with the ring full the rest waits in the hardware buffer
+	while (static_cast<uint8_t>(m_ring_head - m_ring_tail) < SERIAL_RING_SIZE && Serial.available() > 0)
 	{
-		uint8_t incomingByte = Serial.read();
-		buf += static_cast<char>(incomingByte);
+		m_ring[m_ring_head++ & (SERIAL_RING_SIZE - 1)] = static_cast<uint8_t>(Serial.read());
 	}
+	const uint8_t buffered = m_ring_head - m_ring_tail;
+	if (buffered > m_ring_high_water) {
+		m_ring_high_water = buffered;
+	}
+}
 
-	if (buf.length() < 4) {
-		return false;
+uint8_t SerialHandler::read(const uint8_t *&data, uint8_t &len, uint8_t budget) {
+	checkBaud();
+	pump();
+	// at most budget bytes per call, the main loop has LMIC jobs to run
+	while (budget-- > 0 && m_ring_tail != m_ring_head)
+	{
+		if (!parse(m_ring[m_ring_tail++ & (SERIAL_RING_SIZE - 1)])) {
+			continue;
+		}
+		m_last_frame = millis();
+		const uint8_t type = m_frame[0];
+		if (type == MSG_BAUD_PROPOSE || type == MSG_BAUD_CONFIRM) {
+			handleControl();
+			continue;
+		}
+		// valid until the next call of read()
+		data = m_frame + 1;
+		len = m_frame_size - 1;
+		return type;
 	}
-	for (size_t i = 0; i < buf.length(); i++) {
-		if (static_cast<uint8_t>(buf[i]) == MESSAGE_HEADER && buf.length() >= i + 4) { // header, size, data block, chkA, chkB => length >= 5
-			uint8_t payload_size = static_cast<uint8_t>(buf[i+1]);
-			if (buf.length() >= i + 4 + payload_size){
-				str = "";
-				for (size_t j = i + 2; j < i + 2 + payload_size; j++) {
-					str += buf[j];
-				}
-				uint8_t chkA, chkB;
-				fletcherChkSum(str, chkA, chkB);
-				if (chkA != static_cast<uint8_t>(buf[i + 2 + payload_size])
-				|| chkB != static_cast<uint8_t>(buf[i + 3 + payload_size])) {
-					return false;
-				}
-				String temp = "";
-				for (size_t k = i + 5 + payload_size; k < buf.length(); k++) {
-					temp += buf[k];
-				}
-				buf = temp;
-
-				// do stuff with the data
-				return true;
-			}
+	return MSG_NONE;
+}
+
+bool SerialHandler::parse(uint8_t byte) {
+	switch (m_state) {
+	case PARSE_HEADER:
+		if (byte == MESSAGE_HEADER) {
+			m_state = PARSE_SIZE;
 		}
+		break;
+	case PARSE_SIZE:
+		if (byte == 0 || byte > MAX_INBOUND_PAYLOAD) {
+			m_state = PARSE_HEADER;
+			break;
+		}
+		m_frame_size = byte;
+		m_frame_pos = 0;
+		m_chkA = 0;
+		m_chkB = 0;
+		m_state = PARSE_PAYLOAD;
+		break;
+	case PARSE_PAYLOAD:
+		m_frame[m_frame_pos++] = byte;
+		fletcherAdd(byte, m_chkA, m_chkB);
+		if (m_frame_pos == m_frame_size) {
+			m_state = PARSE_CHKA;
+		}
+		break;
+	case PARSE_CHKA:
+		if (byte != m_chkA) {
+			m_rejected_checksum++;
+			m_state = PARSE_HEADER;
+			break;
+		}
+		m_state = PARSE_CHKB;
+		break;
+	case PARSE_CHKB:
+		m_state = PARSE_HEADER;
+		if (byte != m_chkB) {
+			m_rejected_checksum++;
+			break;
+		}
+		return true;
 	}
 	return false;
 }
 
-void SerialHandler::fletcherChkSum(const String&  buf, uint8_t& chkA, uint8_t& chkB)
-{
-    // calc Fletcher checksum, ignore the message header (b5 62)
-	chkA = 0;
-    chkB = 0;
-    for (size_t i = 0; i < buf.length(); i++)
-    {
-        chkA += static_cast<uint8_t>(buf[i]);
-        chkB += chkA;
-    }
+void SerialHandler::handleControl() {
+	const uint8_t type = m_frame[0];
+	if (type == MSG_BAUD_PROPOSE && m_frame_size >= 5) {
+		uint32_t baud = 0;
+		for (uint8_t k = 0; k < 4; k++) {
+			baud |= static_cast<uint32_t>(m_frame[1 + k]) << (8 * k);
+		}
+		if (m_baud_pending || !baudSupported(baud)) {
+			baud = 0;
+		}
+		send(MSG_BAUD_ACK, reinterpret_cast<const uint8_t *>(&baud), sizeof(baud));
+		if (baud != 0 && baud != m_baud) {
+			m_previous_baud = m_baud;
+			switchBaud(baud);
+			m_baud_pending = true;
+			m_baud_deadline = millis() + BAUD_CONFIRM_TIMEOUT;
+		}
+	} else if (type == MSG_BAUD_CONFIRM) {
+		// also answered outside of a negotiation, the raspi uses it as a ping
+		m_baud_pending = false;
+		send(MSG_BAUD_CONFIRM, nullptr, 0);
+	}
+}
+
+void SerialHandler::switchBaud(uint32_t baud) {
+	Serial.flush(); // let pending frames leave at the old rate
+	Serial.end();
+	Serial.begin(baud, SERIAL_8N1);
+	m_baud = baud;
+	m_last_frame = millis();
+	// anything not parsed yet came in at the old rate
+	m_ring_tail = m_ring_head;
+	m_state = PARSE_HEADER;
+}
+
+void SerialHandler::checkBaud() {
+	if (m_baud_pending && static_cast<long>(millis() - m_baud_deadline) >= 0) {
+		m_baud_pending = false;
+		switchBaud(m_previous_baud);
+		send(F("baud confirm timeout"));
+	} else if (!m_baud_pending && m_baud != m_safe_baud && millis() - m_last_frame > BAUD_SILENCE_TIMEOUT) {
+		switchBaud(m_safe_baud);
+		send(F("baud fallback, raspi silent"));
+	}
+}
+
+uint8_t SerialHandler::rxHighWater() const {
+	return m_rx_high_water;
+}
+
+uint8_t SerialHandler::ringHighWater() const {
+	return m_ring_high_water;
+}
+
+uint16_t SerialHandler::rejectedChecksum() const {
+	return m_rejected_checksum;
+}
+
+bool SerialHandler::baudSupported(uint32_t baud) {
+	return baud == 115200ul || baud == 250000ul || baud == 500000ul || baud == 1000000ul;
 }
 
 bool SerialHandler::send(const char *data){
@@ -76,19 +195,28 @@ bool SerialHandler::send(const char *data){
 }
 
 bool SerialHandler::send(const String &data) {
-	if (data.length() > 255u){
+	return send(MSG_LOG, reinterpret_cast<const uint8_t *>(data.c_str()), data.length());
+}
+
+bool SerialHandler::send(uint8_t type, const uint8_t *data, size_t len) {
+	if (len > MAX_FRAME_PAYLOAD - 1u){
 		return false;
 	}
-	String txBuf{""};
-	txBuf += static_cast<char>(MESSAGE_HEADER);
-	txBuf += static_cast<char>(data.length());
-	txBuf += data;
-	uint8_t chkA, chkB;
-	fletcherChkSum(data, chkA, chkB);
-	txBuf += static_cast<char>(chkA);
-	txBuf += static_cast<char>(chkB);
-	Serial.write(txBuf.c_str());
+	uint8_t chkA = 0, chkB = 0;
+	fletcherAdd(type, chkA, chkB);
+	for (size_t i = 0; i < len; i++) {
+		fletcherAdd(data[i], chkA, chkB);
+	}
+	// write byte wise, binary payloads may contain zeros
+	Serial.write(MESSAGE_HEADER);
+	Serial.write(static_cast<uint8_t>(len + 1));
+	Serial.write(type);
+	if (len > 0) {
+		Serial.write(data, len);
+	}
+	Serial.write(chkA);
+	Serial.write(chkB);
 	// delay(100);
 	// Serial.flush();
 	return true;
-}
\ No newline at end of file
+}
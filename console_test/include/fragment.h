@@ -0,0 +1,62 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Records longer than one LoRa payload travel as fragments on port_fragments:
+ * <record id> <index:7 | last:1> <chunk...>
+ * The chunks joined in index order give back <port> <data...> of the record, the
+ * port it would have been sent on in one piece.
+ * Up to 128 fragments per record, the record id wraps after 256 records.
+ */
+constexpr std::size_t fragment_header_size{2};
+constexpr std::size_t max_fragments{128};
+
+auto fragment(uint8_t record_id, uint8_t port, const std::string &data, std::size_t max_payload) -> std::vector<std::string>;
+
+// Collects fragments, in any order, until a record is complete. Partial records are
+// dropped after the timeout or, oldest first, when they would exceed the memory cap.
+// Once the last fragment is known, indices beyond it are refused and chunks already
+// held beyond it are discarded; a second, different last fragment drops the partial
+// record, since after the record id wrapped its fragments mix with an older one's.
+class reassembler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct record
+    {
+        uint8_t port{0};
+        std::string data{};
+    };
+
+    reassembler(std::chrono::seconds f_timeout, std::size_t f_memory_cap);
+    auto feed(const std::string &fragment, clock::time_point now, record &complete) -> bool;
+    void expire(clock::time_point now);
+    auto buffered() const -> std::size_t;
+    auto dropped() const -> std::size_t;
+
+private:
+    struct partial
+    {
+        clock::time_point first_seen{};
+        std::map<uint8_t, std::string> chunks{};
+        int last_index{-1};
+        std::size_t bytes{0};
+    };
+
+    void erase(std::map<uint8_t, partial>::iterator it);
+
+    std::chrono::seconds m_timeout;
+    std::size_t m_memory_cap;
+    std::map<uint8_t, partial> m_partials{};
+    std::size_t m_buffered{0};
+    std::size_t m_dropped{0};
+};
+
+#endif // FRAGMENT_H
@@ -0,0 +1,25 @@
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+/*
+ * Wakes the main loop when device nodes show up, so a replugged arduino is
+ * reopened as soon as udev created its links rather than on the next retry.
+ * Watches /dev, where the tty appears, and the stable_device_dir links, whose
+ * directory udev removes with the last usb serial device and creates again.
+ */
+class hotplug
+{
+public:
+    hotplug() = default;
+    ~hotplug();
+    auto init() -> bool;
+    auto fd() const -> int;
+    auto drain() -> bool; // true if anything was created since the last call
+
+private:
+    void watch_stable_links();
+
+    int m_fd{-1};
+};
+
+#endif // HOTPLUG_H
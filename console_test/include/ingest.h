@@ -0,0 +1,57 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <poll.h>
+
+class uplink_queue;
+class stream_registry;
+
+/*
+ * Local ingest endpoint for detector daemons, a SOCK_SEQPACKET unix socket.
+ * Every packet is one batch and gets exactly one reply, so a producer needs a
+ * single send() and recv() per batch no matter how many records it carries.
+ *
+ * batch: { <stream> <len u16 le> <data...> } repeated until the end of the packet
+ * reply: <ingest_status> <accepted u16 le> <queue fill in percent>
+ *
+ * Records are taken in order, accepted counts the leading records that made it
+ * into the queue. The rest of the batch has to be sent again later. The stream
+ * picks the FPort and codec, see stream_registry. Records too long for one uplink
+ * are fragmented, up to max_record_size after encoding.
+ */
+enum ingest_status : uint8_t
+{
+    INGEST_OK = 0x00,
+    INGEST_SLOW_DOWN = 0x01, // all accepted, but the queue is above the high watermark
+    INGEST_FULL = 0x02,      // queue full, not everything was accepted
+    INGEST_MALFORMED = 0x03, // truncated, oversized or unknown stream, the rest of the batch was dropped
+};
+
+class ingest
+{
+public:
+    ingest(std::string f_path, uplink_queue &f_queue, const stream_registry &f_streams, int f_verbosity = 0);
+    ~ingest();
+    auto init() -> bool;
+    void add_fds(std::vector<pollfd> &fds) const;
+    void handle(const std::vector<pollfd> &fds);
+
+private:
+    void accept_clients();
+    void serve(int client);
+    void drop(int client);
+
+    std::string m_path;
+    uplink_queue &m_queue;
+    const stream_registry &m_streams;
+    int m_verbosity;
+    int m_listen{-1};
+    std::vector<int> m_clients{};
+    std::vector<char> m_batch{};
+};
+
+#endif // INGEST_H
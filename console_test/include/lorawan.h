@@ -0,0 +1,48 @@
+#ifndef LORAWAN_H
+#define LORAWAN_H
+
+#include <string>
+#include <array>
+#include <cstdint>
+
+using aes_key = std::array<uint8_t, 16>;
+
+// ABP session, the same values the arduino has in arduino/src/main.cpp
+struct lorawan_session
+{
+    uint32_t devaddr{0};
+    aes_key nwkskey{};
+    aes_key appskey{};
+};
+
+// MHDR, FHDR without FOpts, FPort and MIC around the FRMPayload
+constexpr std::size_t lorawan_overhead{13};
+
+/*
+ * Builds LoRaWAN 1.0 unconfirmed data up frames (PHYPayload) like LMIC does for the
+ * arduino, FRMPayload encrypted with the AppSKey and the MIC over the frame with the
+ * NwkSKey, so the arduino only has to put them on air (MSG_UPLINK_RAW).
+ * The encoder owns the uplink frame counter, every frame gets the next one.
+ * test/test_lorawan.cpp checks it against known answers, run it with make test.
+ */
+// AES-128 in ECB mode, blocks must be a multiple of the block size
+auto aes_encrypt(const aes_key &key, const std::string &blocks, std::string &out) -> bool;
+// AES-CMAC as in RFC 4493
+auto aes_cmac(const aes_key &key, const std::string &data, std::string &out) -> bool;
+
+class lorawan_encoder
+{
+public:
+    explicit lorawan_encoder(const lorawan_session &f_session, uint32_t f_fcnt = 0);
+    auto encode(uint8_t port, const std::string &payload) -> std::string;
+    auto fcnt() const -> uint32_t;
+
+    // empty if the crypto library failed
+    static auto encode(const lorawan_session &session, uint32_t fcnt, uint8_t port, const std::string &payload) -> std::string;
+
+private:
+    lorawan_session m_session;
+    uint32_t m_fcnt;
+};
+
+#endif // LORAWAN_H
@@ -0,0 +1,27 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <map>
+
+// values written out in the Prometheus text format, meant for the node_exporter textfile collector;
+// names ending in _total are typed as counters, everything else as gauges
+class metrics
+{
+public:
+    explicit metrics(std::string f_path);
+    void set(const std::string &name, double value, const std::string &help = "");
+    auto write() const -> bool;
+
+private:
+    struct entry
+    {
+        double value{0};
+        std::string help{};
+    };
+
+    std::string m_path;
+    std::map<std::string, entry> m_entries{};
+};
+
+#endif // METRICS_H
@@ -3,19 +3,97 @@
 
 #include <string>
 #include <iostream>
+#include <deque>
+#include <chrono>
 
+// first payload byte of every serial frame, keep in sync with arduino/include/serialhandler.h
+enum message_type : uint8_t
+{
+    MSG_NONE = 0x00,
+    MSG_UPLINK = 0x01,         // raspi -> arduino: <id> <fport> <lora payload>
+    MSG_LOG = 0x02,            // arduino -> raspi: <status text>
+    MSG_UPLINK_STATUS = 0x03,  // arduino -> raspi: <id> <uplink_status>
+    MSG_UPLINK_RAW = 0x04,     // raspi -> arduino: <id> <PHYPayload>, see lorawan_encoder
+    MSG_BAUD_PROPOSE = 0x10,   // raspi -> arduino: <baud u32 le>
+    MSG_BAUD_ACK = 0x11,       // arduino -> raspi: <baud u32 le>, 0 if the rate is refused
+    MSG_BAUD_CONFIRM = 0x12,   // both directions, first frame at the new rate
+    MSG_LOOP_STATS = 0x20,     // arduino -> raspi: see loop_stats
+    MSG_LOOP_STATS_REQ = 0x21, // raspi -> arduino: report loop stats now
+    MSG_HEALTH = 0x22,         // arduino -> raspi: see health
+    MSG_HEALTH_REQ = 0x23,     // raspi -> arduino: report health now
+};
+
+enum uplink_status : uint8_t
+{
+    UPLINK_REJECTED = 0x00, // queue full or too long, may be sent again
+    UPLINK_DONE = 0x01,     // LMIC reported EV_TXCOMPLETE, or the raw frame went out
+    UPLINK_QUEUED = 0x02,   // in the arduino queue, SENDING and DONE or REJECTED follow
+    UPLINK_SENDING = 0x03,  // on air, gone out even if DONE never arrives
+};
+
+constexpr std::size_t max_frame_payload{0xfb}; // type + data
+constexpr const char *default_device{"/dev/ttyACM0"};
+// udev links every usb serial device here by vendor, product and serial number
+constexpr const char *stable_device_dir{"/dev/serial/by-id"};
+
+// what serial::keepalive() found
+enum link_check : uint8_t
+{
+    LINK_OK = 0x00,
+    LINK_SILENT = 0x01, // no frame for too long, fell back to the safe rate on this side
+    LINK_NOISY = 0x02,  // framing errors piling up, still connected: negotiate a slower rate
+};
+
+struct message
+{
+    uint8_t type{MSG_NONE};
+    std::string payload{};
+};
+
+// The link to the arduino. A read or write error, EOF or hangup closes the port,
+// connected() turns false and reopen() tries the same device again, through its
+// /dev/serial/by-id link if there is one, since the tty name may change on replug.
+// The link is looked up on every reopen() until found, the device may be missing
+// when init() runs; init() fails then, but reopen() keeps trying.
 class serial{
 public:
     serial(int f_verbosity = 0);
     ~serial();
-    auto init(const unsigned baud_rate = 9600) -> bool;
-    auto send(const std::string &data) const -> bool;
-    auto receive() -> std::string;
+    auto init(const unsigned baud_rate = 9600, const std::string &device = default_device) -> bool;
+    auto reopen() -> bool;
+    void disconnect(const char *reason);
+    auto connected() const -> bool;
+    auto device() const -> const std::string &;
+    auto negotiate_baud(const unsigned baud_rate) -> bool;
+    // call every pass: pings the arduino and watches silence and the framing error rate
+    auto keepalive() -> link_check;
+    auto baud() const -> unsigned;
+    auto safe_baud() const -> unsigned;
+    auto error_total() const -> unsigned long;
+    auto send(const std::string &data) -> bool;
+    auto send(uint8_t type, const std::string &data) -> bool;
+    auto receive(std::chrono::milliseconds timeout = std::chrono::milliseconds{500}) -> message;
+    auto fd() const -> int;
 private:
     static void fletcherChkSum(const std::string& str, uint8_t& chkA, uint8_t& chkB);
-    int serial_port{0};
+    static auto stable_path(const std::string &device) -> std::string;
+    auto open_port(const unsigned baud_rate) -> bool;
+    auto set_baud(const unsigned baud_rate) -> bool;
+    auto parse() -> message;
+    auto wait_for(uint8_t type, std::chrono::milliseconds timeout) -> message;
+    int serial_port{-1};
     int m_verbosity;
+    std::string m_requested{}; // as given to init()
+    std::string m_device{};    // what is opened, the by-id link once one was found
     std::string buf{};
+    std::deque<message> m_pending{};
+    unsigned m_baud{0};
+    unsigned m_safe_baud{0};
+    unsigned long m_error_total{0};
+    unsigned long m_window_errors{0}; // m_error_total when the current error window started
+    std::chrono::steady_clock::time_point m_window_start{};
+    std::chrono::steady_clock::time_point m_last_rx{};
+    std::chrono::steady_clock::time_point m_last_ping{};
 };
 
-#endif // SERIAL_H
\ No newline at end of file
+#endif // SERIAL_H
@@ -0,0 +1,64 @@
+#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Logical uplink streams. Producers tag their records with the stream id on the
+ * ingest socket, on air every stream has its own FPort, so no payload byte is spent
+ * on a type tag. The application server tells the streams apart by port.
+ */
+constexpr uint8_t stream_events{0x01};
+constexpr uint8_t stream_rates{0x02};
+constexpr uint8_t stream_health{0x03};
+// records too long for one uplink, only the uplink queue sends on it
+constexpr uint8_t stream_fragments{0xff};
+
+// keep in sync with the payload formatters on the application server
+constexpr uint8_t port_events{1};
+constexpr uint8_t port_rates{2};
+constexpr uint8_t port_health{3};
+constexpr uint8_t port_fragments{4};
+
+// application ports, 0 is for MAC commands and 224 and up are reserved
+constexpr uint8_t min_app_port{1};
+constexpr uint8_t max_app_port{223};
+
+// turns a record from a producer into the FRMPayload, empty if it cannot be encoded
+using codec = auto (*)(const std::string &record) -> std::string;
+
+/*
+ * Codecs, all numbers on air are unsigned LEB128 varints (7 bits per byte, low
+ * group first, high bit set on all but the last byte).
+ * events: record  { <timestamp ns u64 le> } ascending
+ *         payload <first timestamp> { <difference to the previous one> }
+ * rates:  record  { <count u32 le> }
+ *         payload { <count> }
+ * health: the HealthFrame as the arduino sends it, already packed, no codec
+ */
+auto encode_events(const std::string &record) -> std::string;
+auto encode_rates(const std::string &record) -> std::string;
+
+struct stream
+{
+    uint8_t id{0};
+    const char *name{""};
+    uint8_t port{0};
+    codec encode{nullptr}; // nullptr sends the record as it is
+};
+
+class stream_registry
+{
+public:
+    stream_registry(); // events, rates, health and fragments
+    auto add(const stream &s) -> bool;
+    auto by_id(uint8_t id) const -> const stream *;
+    auto by_port(uint8_t port) const -> const stream *;
+
+private:
+    std::vector<stream> m_streams{};
+};
+
+#endif // STREAMS_H
@@ -0,0 +1,48 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include <iostream>
+#include <cstdint>
+
+class metrics;
+
+// decoded MSG_LOOP_STATS, layout of LoopStatsFrame in arduino/include/loopmonitor.h
+struct loop_stats
+{
+    uint32_t loop_max_us{0};
+    uint32_t loop_avg_us{0};
+    uint32_t loops{0};
+    uint32_t deferred{0};
+    uint32_t rx_late_max_us{0};
+    uint32_t job_late_max_us{0};
+    uint16_t rx_windows{0};
+    uint16_t rx_missed{0};
+
+    static auto decode(const std::string &payload, loop_stats &stats) -> bool;
+    void export_to(metrics &m) const;
+};
+
+// decoded MSG_HEALTH, layout of HealthFrame in arduino/include/health.h
+struct health
+{
+    uint16_t free_sram{0};
+    uint16_t largest_block{0};
+    uint8_t serial_rx_high_water{0};
+    uint8_t queue_depth{0};
+    uint16_t opmode{0};
+    uint8_t datarate{0};
+    uint32_t seqno_up{0};
+    uint16_t rejected_checksum{0};
+    uint16_t rejected_overflow{0};
+    uint8_t serial_ring_high_water{0};
+    uint32_t uptime_s{0};
+
+    static auto decode(const std::string &payload, health &h) -> bool;
+    void export_to(metrics &m) const;
+};
+
+auto operator<<(std::ostream &os, const loop_stats &stats) -> std::ostream &;
+auto operator<<(std::ostream &os, const health &h) -> std::ostream &;
+
+#endif // TELEMETRY_H
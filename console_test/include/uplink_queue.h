@@ -0,0 +1,112 @@
+#ifndef UPLINK_QUEUE_H
+#define UPLINK_QUEUE_H
+
+#include <string>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <cstdint>
+
+#include "fragment.h"
+#include "streams.h"
+
+// largest FRMPayload the arduino accepts, UPLINK_MAX_PAYLOAD in arduino/include/muonpi_lmic.h
+constexpr std::size_t max_lora_payload{51};
+// longest record the fragmentation layer can carry, the port byte included
+constexpr std::size_t max_record_size{max_fragments * (max_lora_payload - fragment_header_size)};
+
+struct uplink
+{
+    uint8_t port{0};        // FPort of the stream, see stream_registry
+    std::string payload{};
+    bool fragment{false};
+    unsigned rejects{0};    // by the arduino, see uplink_queue::rejected()
+};
+
+// the arduino answers every uplink with UPLINK_QUEUED or UPLINK_REJECTED right away,
+// without an answer the frame or the answer got lost on the serial line
+constexpr std::chrono::seconds uplink_ack_timeout{2};
+// longest an accepted uplink may take to go out: a full arduino queue at SF12 and 1% duty cycle
+constexpr std::chrono::minutes uplink_done_timeout{30};
+// a rejected uplink waits 1, 2, 4, 8 s before the next try and is dropped after this many rejects
+constexpr std::chrono::seconds uplink_reject_backoff{1};
+constexpr unsigned uplink_max_rejects{5};
+
+// Uplinks waiting for the arduino and the ones handed to it but not confirmed yet.
+// At most window uplinks are in flight so the arduino queue never overflows.
+// An uplink the arduino did not acknowledge in time goes back into its lane, one it
+// accepted but never reported done is dropped, it may have gone out already. Ids of
+// timed out uplinks are not reused while a late answer for them may still come in.
+// When the arduino is lost, uplinks it had not put on air yet go back into their lanes.
+// The ones it reported UPLINK_SENDING for, and the ones it was handed before them,
+// since its queue is first in first out, are dropped and counted as unconfirmed:
+// they went out, a resend would be a duplicate. Only a lost SENDING still leads to one.
+// Rejected uplinks wait out a growing backoff in a lane of their own, so they neither
+// hammer a full arduino queue nor hold up the others, and are dropped after
+// uplink_max_rejects tries.
+// Records too long for one uplink are split into fragments which wait in their own
+// lane. When both lanes hold data, one fragment goes out after every interleave
+// regular uplinks, so large records neither starve nor delay alerts for long.
+class uplink_queue
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    uplink_queue(std::size_t f_capacity, std::size_t f_window, std::size_t f_interleave = 4);
+    auto push(uplink record) -> bool;
+    auto ready(clock::time_point now) const -> bool;
+    auto take(uint8_t &id, clock::time_point now) -> uplink;
+    void queued(uint8_t id);
+    void sending(uint8_t id);
+    void done(uint8_t id);
+    void rejected(uint8_t id, clock::time_point now);
+    void expire(clock::time_point now);
+    void requeue_in_flight();
+    auto size() const -> std::size_t;
+    auto in_flight() const -> std::size_t;
+    auto fill() const -> double;
+    auto ack_timeouts() const -> unsigned long;
+    auto done_timeouts() const -> unsigned long;
+    auto dropped() const -> unsigned long;
+    auto unconfirmed() const -> unsigned long;
+
+private:
+    struct in_flight_entry
+    {
+        uint8_t id{0};
+        uplink record{};
+        clock::time_point sent_at{};
+        bool queued{false};  // the arduino acknowledged it
+        bool sending{false}; // and put it on air
+    };
+
+    struct retry_entry
+    {
+        uplink record{};
+        clock::time_point not_before{};
+    };
+
+    auto due_retry(clock::time_point now) const -> std::deque<retry_entry>::const_iterator;
+    auto find(uint8_t id) -> std::deque<in_flight_entry>::iterator;
+    auto id_in_use(uint8_t id, clock::time_point now) const -> bool;
+    void retire(uint8_t id, clock::time_point now);
+    void requeue(in_flight_entry &entry);
+
+    std::size_t m_capacity;
+    std::size_t m_window;
+    std::size_t m_interleave;
+    std::deque<uplink> m_pending{};
+    std::deque<uplink> m_fragments{};
+    std::deque<retry_entry> m_retry{};
+    std::deque<in_flight_entry> m_in_flight{};
+    std::map<uint8_t, clock::time_point> m_retired{}; // timed out ids and since when
+    uint8_t m_next_id{0};
+    uint8_t m_next_record_id{0};
+    std::size_t m_since_fragment{0};
+    unsigned long m_ack_timeouts{0};
+    unsigned long m_done_timeouts{0};
+    unsigned long m_dropped{0};
+    unsigned long m_unconfirmed{0};
+};
+
+#endif // UPLINK_QUEUE_H
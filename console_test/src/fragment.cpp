@@ -0,0 +1,154 @@
+#include "../include/fragment.h"
+
+#include <algorithm>
+
+constexpr uint8_t last_fragment_flag{0x80};
+
+auto fragment(uint8_t record_id, uint8_t port, const std::string &data, std::size_t max_payload) -> std::vector<std::string>
+{
+    if (max_payload <= fragment_header_size)
+    {
+        return {};
+    }
+    const std::string record = static_cast<char>(port) + data;
+    const std::size_t chunk_size = max_payload - fragment_header_size;
+    const std::size_t count = (record.size() + chunk_size - 1) / chunk_size;
+    if (count > max_fragments)
+    {
+        return {};
+    }
+    std::vector<std::string> fragments{};
+    for (std::size_t index = 0; index < count; index++)
+    {
+        uint8_t index_byte = static_cast<uint8_t>(index);
+        if (index + 1 == count)
+        {
+            index_byte |= last_fragment_flag;
+        }
+        fragments.push_back(std::string{static_cast<char>(record_id), static_cast<char>(index_byte)}
+                            + record.substr(index * chunk_size, chunk_size));
+    }
+    return fragments;
+}
+
+reassembler::reassembler(std::chrono::seconds f_timeout, std::size_t f_memory_cap)
+    : m_timeout{f_timeout}
+    , m_memory_cap{f_memory_cap} {}
+
+auto reassembler::feed(const std::string &fragment, clock::time_point now, record &complete) -> bool
+{
+    expire(now);
+    if (fragment.size() < fragment_header_size)
+    {
+        return false;
+    }
+    const auto record_id = static_cast<uint8_t>(fragment[0]);
+    const auto index_byte = static_cast<uint8_t>(fragment[1]);
+    const uint8_t index = index_byte & ~last_fragment_flag;
+    std::string chunk = fragment.substr(2);
+
+    // make room, oldest partial record first
+    while (!m_partials.empty() && m_buffered + chunk.size() > m_memory_cap)
+    {
+        auto oldest = std::min_element(m_partials.begin(), m_partials.end(), [](const auto &a, const auto &b) {
+            return a.second.first_seen < b.second.first_seen;
+        });
+        erase(oldest);
+        m_dropped++;
+    }
+    if (chunk.size() > m_memory_cap)
+    {
+        return false;
+    }
+
+    const bool last = index_byte & last_fragment_flag;
+    auto it = m_partials.find(record_id);
+    if (it != m_partials.end() && last && it->second.last_index >= 0 && it->second.last_index != index)
+    {
+        // two different ends, fragments of two records with the same id got mixed
+        erase(it);
+        m_dropped++;
+        it = m_partials.end();
+    }
+    if (it == m_partials.end())
+    {
+        it = m_partials.emplace(record_id, partial{}).first;
+        it->second.first_seen = now;
+    }
+    auto &p = it->second;
+    if (last)
+    {
+        p.last_index = index;
+        // whatever lies beyond the end belongs to an older record with the same id
+        for (auto stale = p.chunks.upper_bound(index); stale != p.chunks.end(); stale = p.chunks.erase(stale))
+        {
+            p.bytes -= stale->second.size();
+            m_buffered -= stale->second.size();
+        }
+    }
+    else if (p.last_index >= 0 && index >= p.last_index)
+    {
+        return false;
+    }
+    if (p.chunks.count(index) == 0)
+    {
+        // a repeated fragment keeps its first copy
+        p.bytes += chunk.size();
+        m_buffered += chunk.size();
+        p.chunks.emplace(index, std::move(chunk));
+    }
+    // the keys are unique and none is past the end, so this means exactly 0 to last_index
+    if (p.last_index < 0 || p.chunks.size() != static_cast<std::size_t>(p.last_index) + 1
+        || p.chunks.rbegin()->first != p.last_index)
+    {
+        return false;
+    }
+    std::string joined{};
+    joined.reserve(p.bytes);
+    for (const auto &entry : p.chunks)
+    {
+        joined += entry.second;
+    }
+    erase(it);
+    if (joined.empty())
+    {
+        return false;
+    }
+    complete.port = static_cast<uint8_t>(joined[0]);
+    complete.data = joined.substr(1);
+    return true;
+}
+
+void reassembler::expire(clock::time_point now)
+{
+    for (auto it = m_partials.begin(); it != m_partials.end();)
+    {
+        if (now - it->second.first_seen > m_timeout)
+        {
+            auto next = std::next(it);
+            erase(it);
+            m_dropped++;
+            it = next;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+auto reassembler::buffered() const -> std::size_t
+{
+    return m_buffered;
+}
+
+auto reassembler::dropped() const -> std::size_t
+{
+    return m_dropped;
+}
+
+void reassembler::erase(std::map<uint8_t, partial>::iterator it)
+{
+    m_buffered -= it->second.bytes;
+    m_partials.erase(it);
+}
@@ -0,0 +1,68 @@
+#include "../include/hotplug.h"
+#include "../include/serial.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+constexpr uint32_t watch_events{IN_CREATE | IN_ATTRIB | IN_MOVED_TO};
+
+hotplug::~hotplug()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+auto hotplug::init() -> bool
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+    {
+        printf("Error %i from inotify_init: %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    if (inotify_add_watch(m_fd, "/dev", watch_events) < 0)
+    {
+        printf("Error %i from inotify_add_watch(/dev): %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    watch_stable_links();
+    return true;
+}
+
+auto hotplug::fd() const -> int
+{
+    return m_fd;
+}
+
+auto hotplug::drain() -> bool
+{
+    bool created{false};
+    alignas(inotify_event) char events[4096];
+    for (;;)
+    {
+        auto num_bytes = read(m_fd, events, sizeof(events));
+        if (num_bytes <= 0)
+        {
+            break;
+        }
+        created = true;
+    }
+    if (created)
+    {
+        // the directory may be new, watching it again is harmless
+        watch_stable_links();
+    }
+    return created;
+}
+
+void hotplug::watch_stable_links()
+{
+    // missing while no usb serial device is plugged in, /dev catches its return
+    inotify_add_watch(m_fd, stable_device_dir, watch_events);
+}
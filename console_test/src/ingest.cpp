@@ -0,0 +1,212 @@
+#include "../include/ingest.h"
+#include "../include/uplink_queue.h"
+#include "../include/streams.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr std::size_t max_batch_size{0x10000};
+constexpr std::size_t max_clients{32};
+constexpr double slow_down_fill{0.75};
+
+ingest::ingest(std::string f_path, uplink_queue &f_queue, const stream_registry &f_streams, int f_verbosity)
+    : m_path{std::move(f_path)}
+    , m_queue{f_queue}
+    , m_streams{f_streams}
+    , m_verbosity{f_verbosity}
+    , m_batch(max_batch_size) {}
+
+ingest::~ingest()
+{
+    for (int client : m_clients)
+    {
+        close(client);
+    }
+    if (m_listen >= 0)
+    {
+        close(m_listen);
+        unlink(m_path.c_str());
+    }
+}
+
+auto ingest::init() -> bool
+{
+    sockaddr_un addr{};
+    if (m_path.size() >= sizeof(addr.sun_path))
+    {
+        printf("Error: ingest socket path too long: %s\n", m_path.c_str());
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    m_listen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen < 0)
+    {
+        printf("Error %i from socket: %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    // a stale socket from an earlier run would make bind() fail
+    unlink(m_path.c_str());
+    if (bind(m_listen, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        printf("Error %i from bind(%s): %s\n", errno, m_path.c_str(), std::strerror(errno));
+        return false;
+    }
+    if (listen(m_listen, static_cast<int>(max_clients)) != 0)
+    {
+        printf("Error %i from listen: %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void ingest::add_fds(std::vector<pollfd> &fds) const
+{
+    fds.push_back({m_listen, POLLIN, 0});
+    for (int client : m_clients)
+    {
+        fds.push_back({client, POLLIN, 0});
+    }
+}
+
+void ingest::handle(const std::vector<pollfd> &fds)
+{
+    std::vector<int> readable{};
+    bool incoming{false};
+    for (const auto &pfd : fds)
+    {
+        if (pfd.revents == 0)
+        {
+            continue;
+        }
+        if (pfd.fd == m_listen)
+        {
+            incoming = true;
+        }
+        else if (std::find(m_clients.begin(), m_clients.end(), pfd.fd) != m_clients.end())
+        {
+            readable.push_back(pfd.fd);
+        }
+    }
+    for (int client : readable)
+    {
+        serve(client);
+    }
+    if (incoming)
+    {
+        accept_clients();
+    }
+}
+
+void ingest::accept_clients()
+{
+    for (;;)
+    {
+        int client = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                printf("Error %i from accept: %s\n", errno, std::strerror(errno));
+            }
+            return;
+        }
+        if (m_clients.size() >= max_clients)
+        {
+            close(client);
+            continue;
+        }
+        m_clients.push_back(client);
+        if (m_verbosity > 0)
+        {
+            std::cout << "ingest: producer connected, " << m_clients.size() << " total" << std::endl;
+        }
+    }
+}
+
+void ingest::serve(int client)
+{
+    // MSG_TRUNC makes recv() report the real packet size even if it did not fit
+    auto num_bytes = recv(client, m_batch.data(), m_batch.size(), MSG_TRUNC);
+    if (num_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (num_bytes <= 0)
+    {
+        drop(client);
+        return;
+    }
+    const std::size_t size = std::min(static_cast<std::size_t>(num_bytes), m_batch.size());
+    ingest_status status{static_cast<std::size_t>(num_bytes) > m_batch.size() ? INGEST_MALFORMED : INGEST_OK};
+    uint16_t accepted{0};
+    std::size_t pos{0};
+    while (status == INGEST_OK && pos < size)
+    {
+        if (pos + 3 > size)
+        {
+            status = INGEST_MALFORMED;
+            break;
+        }
+        const stream *s = m_streams.by_id(static_cast<uint8_t>(m_batch[pos]));
+        const std::size_t len = static_cast<uint8_t>(m_batch[pos + 1]) | (static_cast<std::size_t>(static_cast<uint8_t>(m_batch[pos + 2])) << 8);
+        if (pos + 3 + len > size || s == nullptr || s->id == stream_fragments)
+        {
+            status = INGEST_MALFORMED;
+            break;
+        }
+        std::string record(&m_batch[pos + 3], len);
+        if (s->encode != nullptr)
+        {
+            record = s->encode(record);
+        }
+        if (record.empty() || record.size() + 1 > max_record_size)
+        {
+            status = INGEST_MALFORMED;
+            break;
+        }
+        if (!m_queue.push({s->port, std::move(record)}))
+        {
+            status = INGEST_FULL;
+            break;
+        }
+        pos += 3 + len;
+        accepted++;
+    }
+    if (status == INGEST_OK && m_queue.fill() >= slow_down_fill)
+    {
+        status = INGEST_SLOW_DOWN;
+    }
+    const char reply[4]{
+        static_cast<char>(status),
+        static_cast<char>(accepted & 0xff),
+        static_cast<char>(accepted >> 8),
+        static_cast<char>(std::min(100.0, m_queue.fill() * 100.0))};
+    if (send(client, reply, sizeof(reply), MSG_NOSIGNAL) < 0)
+    {
+        drop(client);
+        return;
+    }
+    if (m_verbosity > 0)
+    {
+        std::cout << "ingest: batch of " << size << " bytes, " << accepted << " accepted, status " << static_cast<int>(status) << std::endl;
+    }
+}
+
+void ingest::drop(int client)
+{
+    close(client);
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+    if (m_verbosity > 0)
+    {
+        std::cout << "ingest: producer disconnected, " << m_clients.size() << " left" << std::endl;
+    }
+}
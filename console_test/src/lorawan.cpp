@@ -0,0 +1,110 @@
+#include "../include/lorawan.h"
+
+#include <openssl/evp.h>
+#include <cstdio>
+
+constexpr uint8_t mhdr_unconfirmed_up{0x40};
+constexpr uint8_t direction_up{0x00};
+constexpr std::size_t block_size{16};
+
+namespace
+{
+void append_u16(std::string &out, uint32_t value)
+{
+    out += static_cast<char>(value & 0xff);
+    out += static_cast<char>((value >> 8) & 0xff);
+}
+
+void append_u32(std::string &out, uint32_t value)
+{
+    append_u16(out, value & 0xffff);
+    append_u16(out, value >> 16);
+}
+
+// the A and B0 blocks of the LoRaWAN 1.0 specification, chapter 4.3.3 and 4.4
+auto block(uint8_t first, uint32_t devaddr, uint32_t fcnt, uint8_t last) -> std::string
+{
+    std::string out{static_cast<char>(first), 0, 0, 0, 0, static_cast<char>(direction_up)};
+    append_u32(out, devaddr);
+    append_u32(out, fcnt);
+    out += '\0';
+    out += static_cast<char>(last);
+    return out;
+}
+} // namespace
+
+auto aes_encrypt(const aes_key &key, const std::string &blocks, std::string &out) -> bool
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr)
+    {
+        return false;
+    }
+    out.resize(blocks.size());
+    int len{0};
+    const bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), nullptr, key.data(), nullptr) == 1
+                    && EVP_CIPHER_CTX_set_padding(ctx, 0) == 1
+                    && EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char *>(out.data()), &len, reinterpret_cast<const unsigned char *>(blocks.data()), static_cast<int>(blocks.size())) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok && static_cast<std::size_t>(len) == blocks.size();
+}
+
+auto aes_cmac(const aes_key &key, const std::string &data, std::string &out) -> bool
+{
+    out.resize(block_size);
+    std::size_t len{0};
+    const auto *result = EVP_Q_mac(nullptr, "CMAC", nullptr, "AES-128-CBC", nullptr, key.data(), key.size(),
+                                   reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+                                   reinterpret_cast<unsigned char *>(out.data()), out.size(), &len);
+    return result != nullptr && len == block_size;
+}
+
+lorawan_encoder::lorawan_encoder(const lorawan_session &f_session, uint32_t f_fcnt)
+    : m_session{f_session}
+    , m_fcnt{f_fcnt} {}
+
+auto lorawan_encoder::encode(uint8_t port, const std::string &payload) -> std::string
+{
+    // LMIC counts up before every uplink, the first frame after a reset has FCnt 1
+    return encode(m_session, ++m_fcnt, port, payload);
+}
+
+auto lorawan_encoder::fcnt() const -> uint32_t
+{
+    return m_fcnt;
+}
+
+auto lorawan_encoder::encode(const lorawan_session &session, uint32_t fcnt, uint8_t port, const std::string &payload) -> std::string
+{
+    // FRMPayload xor the key stream S = aes(A1) | aes(A2) | ...
+    std::string counters{};
+    for (std::size_t i = 0; i * block_size < payload.size(); i++)
+    {
+        counters += block(0x01, session.devaddr, fcnt, static_cast<uint8_t>(i + 1));
+    }
+    std::string stream{};
+    if (!aes_encrypt(session.appskey, counters, stream))
+    {
+        printf("Error from AES: could not encrypt FRMPayload\n");
+        return {};
+    }
+
+    std::string frame{static_cast<char>(mhdr_unconfirmed_up)};
+    append_u32(frame, session.devaddr);
+    frame += '\0'; // FCtrl: no ADR, no FOpts
+    append_u16(frame, fcnt & 0xffff);
+    frame += static_cast<char>(port);
+    for (std::size_t i = 0; i < payload.size(); i++)
+    {
+        frame += static_cast<char>(payload[i] ^ stream[i]);
+    }
+
+    // MIC: the first four bytes of cmac(B0 | frame)
+    std::string cmac{};
+    if (!aes_cmac(session.nwkskey, block(0x49, session.devaddr, fcnt, static_cast<uint8_t>(frame.size())) + frame, cmac))
+    {
+        printf("Error from CMAC: could not compute MIC\n");
+        return {};
+    }
+    return frame + cmac.substr(0, 4);
+}
@@ -1,35 +1,347 @@
 #include "../include/main.h"
 #include "../include/serial.h"
+#include "../include/telemetry.h"
+#include "../include/metrics.h"
+#include "../include/uplink_queue.h"
+#include "../include/ingest.h"
+#include "../include/lorawan.h"
+#include "../include/streams.h"
+#include "../include/hotplug.h"
 
-std::string listen(serial &ser)
+#include <vector>
+#include <poll.h>
+
+// tried in order after the arduino started, all are exact at 16 MHz
+constexpr unsigned fast_baud_rates[]{1000000, 500000, 250000};
+
+// Build and encrypt the LoRaWAN frames here and let the arduino only transmit them
+// (MSG_UPLINK_RAW), instead of running AES for every uplink on the ATmega.
+// The raspi owns the frame counter then, it starts over when this program does.
+constexpr bool host_encryption{false};
+
+// ABP session, the same as in arduino/src/main.cpp / DO NOT SHARE
+const lorawan_session session{
+    0x260BC37E,
+    {0xCC, 0xB8, 0xF3, 0xD3, 0xFD, 0x39, 0x75, 0xAE, 0xE4, 0x84, 0x35, 0x90, 0xFE, 0x37, 0x1C, 0x88},
+    {0xA8, 0xDF, 0x3A, 0xC7, 0x51, 0xB2, 0xD1, 0x73, 0xAC, 0x58, 0x81, 0x91, 0xD2, 0x58, 0xCB, 0x4E},
+};
+
+// Outages of the serial link, from losing it until the arduino announced itself again
+struct link_state
+{
+    using clock = std::chrono::steady_clock;
+    bool down{false};
+    clock::time_point lost_at{};
+    clock::time_point reopened_at{};
+    clock::time_point next_attempt{};
+    unsigned long outages{0};
+    double outage_seconds{0};
+};
+
+// retry this often even if no device node showed up
+constexpr std::chrono::seconds reconnect_interval{1};
+// reopened, but no "Starting" after this long: close and open again, which resets the arduino
+constexpr std::chrono::seconds ready_timeout{5};
+
+// ask the arduino how it is doing this often, for the metrics file
+constexpr std::chrono::seconds health_request_interval{60};
+// and put one of the reports on air per interval, on stream_health
+constexpr std::chrono::seconds health_uplink_interval{3600};
+// asking again while a reboot check waits for its answer
+constexpr std::chrono::seconds reboot_check_interval{2};
+
+// Health reports, also how the raspi notices a reboot it did not see "Starting" for:
+// that line goes out at the safe rate, a reset while the link ran faster only shows as
+// silence. After every fallback no uplink goes out until a report compared the uptime.
+struct health_state
+{
+    using clock = std::chrono::steady_clock;
+    clock::time_point next_request{};
+    clock::time_point next_uplink{}; // the first report after start goes out right away
+    bool uptime_known{false};
+    uint32_t uptime_s{0};
+    bool reboot_check{false};
+};
+
+void link_lost(link_state &link, uplink_queue &queue, metrics &stats_export, bool &device_ready)
+{
+    link.down = true;
+    link.lost_at = link_state::clock::now();
+    link.next_attempt = link.lost_at;
+    link.outages++;
+    device_ready = false;
+    // whatever the arduino held and had not sent is lost with it, each goes out once more with a new id
+    queue.requeue_in_flight();
+    stats_export.set("serial_connected", 0);
+    stats_export.set("serial_outages_total", link.outages);
+    stats_export.write();
+}
+
+void link_recovered(link_state &link, metrics &stats_export)
+{
+    link.down = false;
+    const double seconds = std::chrono::duration<double>(link_state::clock::now() - link.lost_at).count();
+    link.outage_seconds += seconds;
+    std::cout << "serial link recovered after " << seconds << " s\n" << std::flush;
+    stats_export.set("serial_connected", 1);
+    stats_export.set("serial_recovery_seconds", seconds, "Time from losing the serial link until the arduino was ready again, last outage");
+    stats_export.set("serial_outage_seconds_total", link.outage_seconds, "Time without a usable serial link");
+    stats_export.write();
+}
+
+void negotiate_fast_baud(serial &ser)
 {
-    std::string rx_data{};
-    while (rx_data.empty())
+    for (auto rate : fast_baud_rates)
     {
-        rx_data = ser.receive();
+        if (ser.negotiate_baud(rate))
+        {
+            break;
+        }
+    }
+    std::cout << "serial at " << std::dec << ser.baud() << " baud\n" << std::flush;
+}
+
+// one step down after framing errors, both sides switch through the usual handshake;
+// the link stays there until the next negotiation after a reboot or a silence fallback
+void downgrade_baud(serial &ser)
+{
+    for (auto rate : fast_baud_rates)
+    {
+        if (rate < ser.baud() && ser.negotiate_baud(rate))
+        {
+            std::cout << "serial down to " << std::dec << rate << " baud\n" << std::flush;
+            return;
+        }
+    }
+    if (ser.negotiate_baud(ser.safe_baud()))
+    {
+        std::cout << "serial down to " << std::dec << ser.safe_baud() << " baud\n" << std::flush;
+    }
+    // otherwise the silence fallback still takes both sides to the safe rate
+}
+
+void handle_message(const message &msg, serial &ser, uplink_queue &queue, metrics &stats_export, health_state &device_health, bool &device_ready, bool &renegotiate)
+{
+    switch (msg.type)
+    {
+    case MSG_LOOP_STATS:
+    {
+        loop_stats stats{};
+        if (loop_stats::decode(msg.payload, stats))
+        {
+            std::cout << stats << "\n" << std::flush;
+            stats.export_to(stats_export);
+            stats_export.write();
+        }
+        break;
+    }
+    case MSG_HEALTH:
+    {
+        health h{};
+        if (health::decode(msg.payload, h))
+        {
+            std::cout << h << "\n" << std::flush;
+            h.export_to(stats_export);
+            stats_export.set("serial_baud", ser.baud(), "Current serial link rate");
+            stats_export.set("serial_errors_total", ser.error_total(), "Framing errors seen by the raspi");
+            stats_export.set("queue_depth", queue.size(), "Uplinks queued on the raspi, including the ones in flight");
+            stats_export.set("uplink_ack_timeouts_total", queue.ack_timeouts(), "Uplinks the arduino did not acknowledge in time, sent again");
+            stats_export.set("uplink_done_timeouts_total", queue.done_timeouts(), "Uplinks the arduino accepted but never reported done, dropped");
+            stats_export.set("uplink_dropped_total", queue.dropped(), "Uplinks dropped after being rejected by the arduino too often");
+            stats_export.set("uplink_unconfirmed_total", queue.unconfirmed(), "Uplinks on air when the arduino was lost, not sent again");
+            stats_export.write();
+            if (device_health.uptime_known && h.uptime_s < device_health.uptime_s)
+            {
+                std::cout << "the arduino rebooted, up " << h.uptime_s << "s\n" << std::flush;
+                queue.requeue_in_flight();
+            }
+            device_health.uptime_known = true;
+            device_health.uptime_s = h.uptime_s;
+            device_health.reboot_check = false;
+            const auto now = health_state::clock::now();
+            // the frame is already packed, it goes on air as it came, see streams.h
+            if (now >= device_health.next_uplink && queue.push({port_health, msg.payload}))
+            {
+                device_health.next_uplink = now + health_uplink_interval;
+            }
+        }
+        break;
+    }
+    case MSG_UPLINK_STATUS:
+        if (msg.payload.size() >= 2)
+        {
+            const auto id = static_cast<uint8_t>(msg.payload[0]);
+            switch (static_cast<uint8_t>(msg.payload[1]))
+            {
+            case UPLINK_DONE:
+                queue.done(id);
+                break;
+            case UPLINK_QUEUED:
+                queue.queued(id);
+                break;
+            case UPLINK_SENDING:
+                queue.sending(id);
+                break;
+            default:
+                queue.rejected(id, link_state::clock::now());
+                break;
+            }
+        }
+        break;
+    case MSG_LOG:
+        std::cout << msg.payload << "\n" << std::flush;
+        if (msg.payload == "Starting")
+        {
+            // the arduino (re)booted, whatever it held is gone
+            queue.requeue_in_flight();
+            // the uptime starts over, the next report must not count this reboot again
+            device_health.uptime_known = false;
+            device_health.reboot_check = false;
+            renegotiate = false;
+            negotiate_fast_baud(ser);
+            ser.send(MSG_HEALTH_REQ, "");
+            // the link may have dropped again during the handshake
+            device_ready = ser.connected();
+        }
+        break;
+    case MSG_BAUD_CONFIRM:
+        // a ping answer, after a fallback the arduino is reachable at the safe rate again
+        if (renegotiate)
+        {
+            renegotiate = false;
+            negotiate_fast_baud(ser);
+        }
+        break;
+    default:
+        break;
     }
-    return rx_data;
 }
 
 int main(){
     constexpr int verbosity{0};
     constexpr int baud_rate{115200};
+    // a link in stable_device_dir survives replugging, the tty name may not
+    constexpr const char *device_path{default_device};
+    // point this into the node_exporter textfile collector directory to scrape it
+    constexpr const char *metrics_path{"muonpi_lorawan.prom"};
+    constexpr const char *ingest_path{"muonpi_lorawan.sock"};
+    constexpr std::size_t queue_capacity{4096};
+    // UPLINK_QUEUE_SIZE on the arduino plus the one LMIC holds
+    constexpr std::size_t device_window{5};
+    // regular uplinks between two fragments of a long record while both are waiting
+    constexpr std::size_t fragment_interleave{4};
     serial ser(verbosity);
-    auto initialized = ser.init(baud_rate);
-    if (initialized)
+    metrics stats_export{metrics_path};
+    uplink_queue queue{queue_capacity, device_window, fragment_interleave};
+    stream_registry streams{};
+    ingest producers{ingest_path, queue, streams, verbosity};
+    lorawan_encoder encoder{session};
+    // a missing arduino is an outage from the start, the loop below waits for it
+    if (!ser.init(baud_rate, device_path))
     {
-        // ser.send("reset");
-        // ser.send("testmessage");
-        while(1){
-            auto msg = listen(ser);
-            std::cout << msg << "\n" << std::flush;
-            if (msg == "Starting" || msg == "EV_TXCOMPLETE"){
-                ser.send("testmessage");
-            }
-        }
+        std::cout << "no arduino at " << device_path << " yet, waiting for it" << std::endl;
+    }
+    hotplug watch{};
+    if (!watch.init())
+    {
+        std::cout << "problem at watching for the serial device, reconnecting on a timer only" << std::endl;
     }
-    else
+    if (!producers.init())
     {
-        std::cout << "problem at initializing serial" << std::endl;
+        std::cout << "problem at initializing the ingest socket" << std::endl;
+        return 1;
     }
-}
\ No newline at end of file
+    bool device_ready{false};
+    // the link fell back to the safe rate, speed up again once the arduino answers
+    bool renegotiate{false};
+    link_state link{};
+    link.down = !ser.connected();
+    link.lost_at = link_state::clock::now();
+    link.next_attempt = link.lost_at;
+    health_state device_health{};
+    stats_export.set("serial_connected", ser.connected() ? 1 : 0, "1 while the serial link to the arduino is open");
+    stats_export.set("serial_outages_total", 0, "Serial link losses, unplugged cable or device errors");
+    std::vector<pollfd> fds{};
+    while (1)
+    {
+        fds.clear();
+        // while disconnected the device watch wakes the loop instead
+        fds.push_back({ser.connected() ? ser.fd() : watch.fd(), POLLIN, 0});
+        producers.add_fds(fds);
+        poll(fds.data(), fds.size(), 500);
+        producers.handle(fds);
+        const auto now = link_state::clock::now();
+        if (!ser.connected())
+        {
+            if (!link.down)
+            {
+                link_lost(link, queue, stats_export, device_ready);
+            }
+            // a new device node or the retry timer, whichever comes first
+            if ((watch.fd() >= 0 && watch.drain()) || now >= link.next_attempt)
+            {
+                link.next_attempt = now + reconnect_interval;
+                if (ser.reopen())
+                {
+                    std::cout << "reopened " << ser.device() << ", waiting for the arduino\n" << std::flush;
+                    link.reopened_at = now;
+                }
+            }
+            continue;
+        }
+        for (auto msg = ser.receive(std::chrono::milliseconds{0}); msg.type != MSG_NONE; msg = ser.receive(std::chrono::milliseconds{0}))
+        {
+            handle_message(msg, ser, queue, stats_export, device_health, device_ready, renegotiate);
+        }
+        if (device_ready)
+        {
+            switch (ser.keepalive())
+            {
+            case LINK_SILENT:
+                renegotiate = true;
+                // silence at a fast rate may be a reset, ask for the uptime right away
+                device_health.reboot_check = true;
+                device_health.next_request = now;
+                break;
+            case LINK_NOISY:
+                downgrade_baud(ser);
+                break;
+            default:
+                break;
+            }
+        }
+        if (link.down && device_ready)
+        {
+            link_recovered(link, stats_export);
+        }
+        else if (link.down && now - link.reopened_at > ready_timeout)
+        {
+            ser.disconnect("no \"Starting\" from the arduino");
+        }
+        if (device_ready && now >= device_health.next_request)
+        {
+            device_health.next_request = now + (device_health.reboot_check ? reboot_check_interval : health_request_interval);
+            ser.send(MSG_HEALTH_REQ, "");
+        }
+        queue.expire(now);
+        while (device_ready && !device_health.reboot_check && ser.connected() && queue.ready(now))
+        {
+            uint8_t id{0};
+            auto record = queue.take(id, now);
+            if (!host_encryption)
+            {
+                ser.send(MSG_UPLINK, std::string{static_cast<char>(id), static_cast<char>(record.port)} + record.payload);
+                continue;
+            }
+            const std::string frame = encoder.encode(record.port, record.payload);
+            if (frame.empty())
+            {
+                // counts as a reject, tried again after the backoff
+                queue.rejected(id, now);
+                break;
+            }
+            ser.send(MSG_UPLINK_RAW, static_cast<char>(id) + frame);
+            stats_export.set("uplink_fcnt", encoder.fcnt(), "Frame counter of the last uplink encrypted on the raspi");
+        }
+    }
+}
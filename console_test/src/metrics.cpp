@@ -0,0 +1,62 @@
+#include "../include/metrics.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+
+constexpr const char *metric_prefix{"muonpi_lora_"};
+constexpr const char *counter_suffix{"_total"};
+
+namespace
+{
+// the Prometheus naming convention, counters and only counters end in _total
+auto metric_type(const std::string &name) -> const char *
+{
+    const std::string suffix{counter_suffix};
+    const bool counter = name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    return counter ? "counter" : "gauge";
+}
+} // namespace
+
+metrics::metrics(std::string f_path)
+    : m_path{std::move(f_path)} {}
+
+void metrics::set(const std::string &name, double value, const std::string &help)
+{
+    auto &e = m_entries[name];
+    e.value = value;
+    if (!help.empty())
+    {
+        e.help = help;
+    }
+}
+
+auto metrics::write() const -> bool
+{
+    // write next to the target and rename, the collector must never see a partial file
+    const std::string tmp_path = m_path + ".tmp";
+    {
+        std::ofstream out{tmp_path, std::ios::trunc};
+        if (!out)
+        {
+            printf("Error %i from open(%s): %s\n", errno, tmp_path.c_str(), std::strerror(errno));
+            return false;
+        }
+        for (const auto &[name, e] : m_entries)
+        {
+            if (!e.help.empty())
+            {
+                out << "# HELP " << metric_prefix << name << ' ' << e.help << '\n';
+            }
+            out << "# TYPE " << metric_prefix << name << ' ' << metric_type(name) << '\n';
+            out << metric_prefix << name << ' ' << e.value << '\n';
+        }
+    }
+    if (std::rename(tmp_path.c_str(), m_path.c_str()) != 0)
+    {
+        printf("Error %i from rename(%s): %s\n", errno, m_path.c_str(), std::strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -15,6 +15,10 @@
 #include <sys/ioctl.h>
 #include <asm/ioctls.h>
 #include <unistd.h> // write(), read(), close()
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h> // realpath()
 #include <chrono>
 #include <thread>
 
@@ -40,11 +44,45 @@
 constexpr uint8_t MESSAGE_HEADER = 0xf9u;
 constexpr std::size_t buffer_size = 0xff;
 
+// keep in sync with arduino/include/serialhandler.h
+constexpr std::chrono::milliseconds baud_reply_timeout{1000};
+constexpr std::chrono::milliseconds link_ping_interval{2000};
+// BAUD_SILENCE_TIMEOUT on the arduino, three pings without an answer
+constexpr std::chrono::milliseconds link_silence_timeout{6000};
+// above the safe rate, this many framing errors within the window call for a slower rate;
+// a link that corrupts frames but still gets a ping through never goes silent
+constexpr std::chrono::seconds link_error_window{10};
+constexpr unsigned long link_error_limit{10};
+
+static auto encode_u32(uint32_t value) -> std::string
+{
+    std::string out{};
+    for (int k = 0; k < 4; k++)
+    {
+        out += static_cast<char>((value >> (8 * k)) & 0xff);
+    }
+    return out;
+}
+
+static auto decode_u32(const std::string &data) -> uint32_t
+{
+    uint32_t value{0};
+    for (std::size_t k = 0; k < 4 && k < data.size(); k++)
+    {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(data[k])) << (8 * k);
+    }
+    return value;
+}
+
 serial::serial(int f_verbosity)
     : m_verbosity{f_verbosity} {}
 
 serial::~serial()
 {
+    if (serial_port < 0)
+    {
+        return;
+    }
     if (ioctl(serial_port, TIOCNXCL))
     {
         printf("Error %i from ioctl(TIOCNXCL): %s\n", errno, std::strerror(errno));
@@ -52,13 +90,111 @@ serial::~serial()
     close(serial_port);
 }
 
-auto serial::init(const unsigned baud_rate) -> bool
+auto serial::init(const unsigned baud_rate, const std::string &device) -> bool
+{
+    m_requested = device;
+    m_device = stable_path(device);
+    if (m_verbosity > 0 && m_device != device)
+    {
+        std::cout << "using " << m_device << " for " << device << std::endl;
+    }
+    m_safe_baud = baud_rate;
+    m_baud = baud_rate;
+    if (!open_port(baud_rate))
+    {
+        return false;
+    }
+
+    // std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    // fcntl(serial_port, F_SETFL, 0);
+    // ioctl(serial_port, TCIOFLUSH);
+    // std::this_thread::sleep_for(std::chrono::milliseconds(70));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1300));
+
+    return true;
+}
+
+auto serial::reopen() -> bool
+{
+    if (connected())
+    {
+        return true;
+    }
+    if (m_device == m_requested)
+    {
+        // nothing to resolve while the device was missing, a by-id link may exist by now
+        m_device = stable_path(m_requested);
+        if (m_device != m_requested)
+        {
+            std::cout << "using " << m_device << " for " << m_requested << std::endl;
+        }
+    }
+    // no waiting for the bootloader here, the arduino announces itself with "Starting"
+    return open_port(m_safe_baud);
+}
+
+void serial::disconnect(const char *reason)
+{
+    if (serial_port < 0)
+    {
+        return;
+    }
+    printf("serial link to %s lost: %s\n", m_device.c_str(), reason);
+    // no TIOCNXCL, the device may be gone already and the lock goes with the last close
+    close(serial_port);
+    serial_port = -1;
+    buf.clear();
+    m_pending.clear();
+}
+
+auto serial::connected() const -> bool
 {
-    serial_port = open("/dev/ttyACM0", O_RDWR);
+    return serial_port >= 0;
+}
+
+auto serial::device() const -> const std::string &
+{
+    return m_device;
+}
+
+auto serial::stable_path(const std::string &device) -> std::string
+{
+    char target[PATH_MAX];
+    if (device.rfind(stable_device_dir, 0) == 0 || realpath(device.c_str(), target) == nullptr)
+    {
+        return device;
+    }
+    DIR *dir = opendir(stable_device_dir);
+    if (dir == nullptr)
+    {
+        return device;
+    }
+    std::string result = device;
+    for (dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        const std::string link = std::string{stable_device_dir} + "/" + entry->d_name;
+        char resolved[PATH_MAX];
+        if (entry->d_name[0] != '.' && realpath(link.c_str(), resolved) != nullptr && std::strcmp(resolved, target) == 0)
+        {
+            result = link;
+            break;
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+auto serial::open_port(const unsigned baud_rate) -> bool
+{
+    serial_port = open(m_device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
 
     if (serial_port < 0)
     {
-        printf("Error %i from open: %s\n", errno, std::strerror(errno));
+        // not there while unplugged, that is what the caller retries for
+        if (errno != ENOENT)
+        {
+            printf("Error %i from open(%s): %s\n", errno, m_device.c_str(), std::strerror(errno));
+        }
         return false;
     }
 
@@ -66,6 +202,8 @@ auto serial::init(const unsigned baud_rate) -> bool
     if (ioctl(serial_port, TIOCEXCL))
     {
         printf("Error %i from ioctl(TIOCEXCL): %s\n", errno, std::strerror(errno));
+        close(serial_port);
+        serial_port = -1;
         return false;
     }
 
@@ -88,6 +226,8 @@ auto serial::init(const unsigned baud_rate) -> bool
 
     if (ioctl(serial_port, TCGETS2, &tty) != 0){
         printf("Error %i from tcgetattr: %s\n", errno, std::strerror(errno));
+        close(serial_port);
+        serial_port = -1;
         return false;
     }
 
@@ -141,7 +281,8 @@ auto serial::init(const unsigned baud_rate) -> bool
     // VMIN: minimum characters received
     // VTIME: timeout
     // 0 means deactivated; read() will block until either VMIN characters received or VTIME deciseconds have passed
-    tty.c_cc[VTIME] = 5; // Wait for up to 0.5s (50 deciseconds), returning as soon as any data is received.
+    // both 0: read() returns right away, receive() waits with poll() so the fd can share a poll loop
+    tty.c_cc[VTIME] = 0;
     tty.c_cc[VMIN] = 0;
 
     // UNIX compliant baud rates:
@@ -160,18 +301,172 @@ auto serial::init(const unsigned baud_rate) -> bool
     // }
     if (ioctl(serial_port, TCSETS2, &tty)) {
         printf("Error %i from tcsetattr: %s\n", errno, std::strerror(errno));
+        close(serial_port);
+        serial_port = -1;
         return false;
     }
+    m_baud = baud_rate;
+    m_last_rx = std::chrono::steady_clock::now();
+    buf.clear();
+    m_pending.clear();
+    return true;
+}
 
-    // std::this_thread::sleep_for(std::chrono::milliseconds(2));
-    // fcntl(serial_port, F_SETFL, 0);
-    // ioctl(serial_port, TCIOFLUSH);
-    // std::this_thread::sleep_for(std::chrono::milliseconds(70));
-    std::this_thread::sleep_for(std::chrono::milliseconds(1300));
+auto serial::baud() const -> unsigned
+{
+    return m_baud;
+}
+
+auto serial::safe_baud() const -> unsigned
+{
+    return m_safe_baud;
+}
+
+auto serial::error_total() const -> unsigned long
+{
+    return m_error_total;
+}
 
+auto serial::set_baud(const unsigned baud_rate) -> bool
+{
+    // tcdrain, the last frame at the old rate has to leave before switching
+    if (ioctl(serial_port, TCSBRK, 1))
+    {
+        printf("Error %i from tcdrain: %s\n", errno, std::strerror(errno));
+    }
+    struct termios2 tty;
+    if (ioctl(serial_port, TCGETS2, &tty) != 0)
+    {
+        printf("Error %i from tcgetattr: %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    tty.c_cflag &= ~CBAUD;
+    tty.c_cflag |= CBAUDEX;
+    tty.c_ispeed = baud_rate;
+    tty.c_ospeed = baud_rate;
+    if (ioctl(serial_port, TCSETS2, &tty))
+    {
+        printf("Error %i from tcsetattr: %s\n", errno, std::strerror(errno));
+        return false;
+    }
+    // whatever arrived around the switch is garbage at one of the two rates
+    ioctl(serial_port, TCFLSH, TCIFLUSH);
+    buf.clear();
+    m_baud = baud_rate;
+    // the new rate gets a full silence timeout and a fresh error window to show it works
+    m_last_rx = std::chrono::steady_clock::now();
+    m_window_start = m_last_rx;
+    m_window_errors = m_error_total;
     return true;
 }
 
+auto serial::wait_for(uint8_t type, std::chrono::milliseconds timeout) -> message
+{
+    std::deque<message> other{};
+    message result{};
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now())
+    {
+        if (!connected())
+        {
+            break;
+        }
+        auto msg = receive(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now));
+        if (msg.type == type)
+        {
+            result = msg;
+            break;
+        }
+        if (msg.type != MSG_NONE)
+        {
+            other.push_back(msg);
+        }
+    }
+    // hand everything else out again on the next calls of receive()
+    m_pending.insert(m_pending.begin(), other.begin(), other.end());
+    return result;
+}
+
+auto serial::negotiate_baud(const unsigned baud_rate) -> bool
+{
+    if (baud_rate == m_baud)
+    {
+        return true;
+    }
+    const unsigned previous = m_baud;
+    if (!send(MSG_BAUD_PROPOSE, encode_u32(baud_rate)))
+    {
+        return false;
+    }
+    auto ack = wait_for(MSG_BAUD_ACK, baud_reply_timeout);
+    if (ack.type != MSG_BAUD_ACK || decode_u32(ack.payload) != baud_rate)
+    {
+        if (m_verbosity > 0)
+        {
+            std::cout << "baud rate " << std::dec << baud_rate << " refused" << std::endl;
+        }
+        return false;
+    }
+    if (!set_baud(baud_rate))
+    {
+        // the arduino reverts on its own without the confirm
+        set_baud(previous);
+        return false;
+    }
+    send(MSG_BAUD_CONFIRM, "");
+    auto confirm = wait_for(MSG_BAUD_CONFIRM, baud_reply_timeout);
+    if (confirm.type != MSG_BAUD_CONFIRM)
+    {
+        if (m_verbosity > 0)
+        {
+            std::cout << "no confirm at " << std::dec << baud_rate << " baud, falling back to " << previous << std::endl;
+        }
+        set_baud(previous);
+        return false;
+    }
+    if (m_verbosity > 0)
+    {
+        std::cout << "switched to " << std::dec << baud_rate << " baud" << std::endl;
+    }
+    return true;
+}
+
+auto serial::keepalive() -> link_check
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_last_ping >= link_ping_interval)
+    {
+        // the arduino answers a confirm outside of a negotiation too
+        send(MSG_BAUD_CONFIRM, "");
+        m_last_ping = now;
+    }
+    if (m_baud == m_safe_baud)
+    {
+        return LINK_OK;
+    }
+    if (now - m_last_rx >= link_silence_timeout)
+    {
+        // the arduino went back to the safe rate after the same silence, or is about to
+        printf("no answer at %u baud, falling back to %u\n", m_baud, m_safe_baud);
+        set_baud(m_safe_baud);
+        return LINK_SILENT;
+    }
+    const unsigned long errors = m_error_total - m_window_errors;
+    if (errors >= link_error_limit)
+    {
+        printf("%lu framing errors at %u baud within %lis\n", errors, m_baud, static_cast<long>(link_error_window.count()));
+        m_window_start = now;
+        m_window_errors = m_error_total;
+        return LINK_NOISY;
+    }
+    if (now - m_window_start >= link_error_window)
+    {
+        m_window_start = now;
+        m_window_errors = m_error_total;
+    }
+    return LINK_OK;
+}
+
 void serial::fletcherChkSum(const std::string &str, uint8_t &chkA, uint8_t &chkB)
 {
     // calc Fletcher checksum, ignore the message header (b5 62)
@@ -184,18 +479,24 @@ void serial::fletcherChkSum(const std::string &str, uint8_t &chkA, uint8_t &chkB
     }
 }
 
-auto serial::send(const std::string &data) const -> bool
+auto serial::send(const std::string &data) -> bool
+{
+    return send(MSG_UPLINK, data);
+}
+
+auto serial::send(uint8_t type, const std::string &data) -> bool
 {
-    if (data.size() > 255)
+    if (!connected() || data.size() > max_frame_payload - 1)
     {
         return false;
     }
+    const std::string payload = static_cast<char>(type) + data;
     uint8_t chkA, chkB;
-    fletcherChkSum(data, chkA, chkB);
+    fletcherChkSum(payload, chkA, chkB);
     std::string txBuf{};
     txBuf += static_cast<char>(MESSAGE_HEADER);
-    txBuf += static_cast<uint8_t>(data.size());
-    txBuf += data;
+    txBuf += static_cast<uint8_t>(payload.size());
+    txBuf += payload;
     txBuf += static_cast<char>(chkA);
     txBuf += static_cast<char>(chkB);
     auto num_bytes = write(serial_port, txBuf.c_str(), txBuf.size());
@@ -208,24 +509,65 @@ auto serial::send(const std::string &data) const -> bool
     if (num_bytes < 0)
     {
         printf("Error %i from write: %s\n", errno, std::strerror(errno));
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            disconnect("write failed");
+        }
         return false;
     }
     return true;
 }
 
-auto serial::receive() -> std::string
+auto serial::fd() const -> int
+{
+    return serial_port;
+}
+
+auto serial::receive(std::chrono::milliseconds timeout) -> message
 {
+    if (!m_pending.empty())
+    {
+        auto msg = m_pending.front();
+        m_pending.pop_front();
+        return msg;
+    }
+    // frames left over from the last read go first
+    auto msg = parse();
+    if (msg.type != MSG_NONE)
+    {
+        return msg;
+    }
+    pollfd pfd{serial_port, POLLIN, 0};
+    if (!connected() || poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0)
+    {
+        return {};
+    }
+    if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+    {
+        disconnect("hangup");
+        return {};
+    }
     char rxBuf[buffer_size];
     auto num_bytes = read(serial_port, &rxBuf, buffer_size);
     if (num_bytes < 0){
         printf("Error %i from read: %s\n", errno, std::strerror(errno));
-        return "";         
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            disconnect("read failed");
+        }
+        return {};
+    }
+    if (num_bytes == 0)
+    {
+        // readable but nothing to read, the tty was hung up
+        disconnect("end of file");
+        return {};
     }
     for (std::size_t i = 0; i < static_cast<std::size_t>(num_bytes); i++)
     {
         buf += rxBuf[i];
     }
-    if (m_verbosity > 0)
+    if (m_verbosity > 1)
     {
         std::cout << num_bytes << " bytes read, buf: " << std::endl;
         for (auto c : buf)
@@ -234,46 +576,51 @@ auto serial::receive() -> std::string
         }
     }
     std::cout << std::flush;
-    if (buf.size() < 4)
-    {
-        return "";
-    }
-    for (std::size_t i = 0; i < buf.size(); i++)
-    {
-        if (static_cast<uint8_t>(buf[i]) == MESSAGE_HEADER && buf.size() >= i + 4)
-        { // header, size, data block, chkA, chkB => size >= 5
-            uint8_t payload_size = static_cast<uint8_t>(buf[i + 1]);
-            if (m_verbosity > 0)
-            {
-                std::cout << "found header at position " << i << std::endl;
-                std::cout << "found payload size to be " << static_cast<int>(payload_size);
-                std::cout << " buf size in total: " << buf.size() << ", needed: " << static_cast<int>(payload_size) + 4 << std::endl;
-            }
-            if (buf.size() >= i + 4 + payload_size)
-            {
-                std::string str{};
-                for (size_t j = i + 2; j < i + 2 + payload_size; j++)
-                {
-                    str += buf[j];
-                }
-                uint8_t chkA, chkB;
-                fletcherChkSum(str, chkA, chkB);
-                if (chkA != static_cast<uint8_t>(buf[i + 2 + payload_size])
-                || chkB != static_cast<uint8_t>(buf[i + 3 + payload_size]))
-                {
-                    return "";
-                }
-                std::string temp = "";
-                for (std::size_t k = i + 5 + payload_size; k < buf.size(); k++)
-                {
-                    temp += buf[k];
-                }
-                buf = temp;
-
-                // do stuff with the data
-                return str;
-            }
+    return parse();
+}
+
+auto serial::parse() -> message
+{
+    std::size_t i{0};
+    while (i + 4 <= buf.size())
+    {
+        if (static_cast<uint8_t>(buf[i]) != MESSAGE_HEADER)
+        {
+            i++;
+            continue;
+        }
+        // header, size, type + data block, chkA, chkB => size >= 5
+        uint8_t payload_size = static_cast<uint8_t>(buf[i + 1]);
+        if (m_verbosity > 1)
+        {
+            std::cout << "found header at position " << i << std::endl;
+            std::cout << "found payload size to be " << static_cast<int>(payload_size);
+            std::cout << " buf size in total: " << buf.size() << ", needed: " << static_cast<int>(payload_size) + 4 << std::endl;
+        }
+        if (buf.size() < i + 4 + payload_size)
+        {
+            break; // wait for the rest of the frame
         }
+        std::string str = buf.substr(i + 2, payload_size);
+        uint8_t chkA, chkB;
+        fletcherChkSum(str, chkA, chkB);
+        if (payload_size == 0 || payload_size > max_frame_payload
+        || chkA != static_cast<uint8_t>(buf[i + 2 + payload_size])
+        || chkB != static_cast<uint8_t>(buf[i + 3 + payload_size]))
+        {
+            // not a frame, resync on the next header byte
+            m_error_total++;
+            i++;
+            continue;
+        }
+        buf.erase(0, i + 4 + payload_size);
+        m_last_rx = std::chrono::steady_clock::now();
+        return {static_cast<uint8_t>(str[0]), str.substr(1)};
     }
-    return "";
-}
\ No newline at end of file
+    if (i > 0 && i <= buf.size())
+    {
+        m_error_total++;
+        buf.erase(0, i);
+    }
+    return {};
+}
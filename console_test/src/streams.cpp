@@ -0,0 +1,109 @@
+#include "../include/streams.h"
+
+#include <cstdio>
+
+namespace
+{
+void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+auto get_le(const std::string &record, std::size_t pos, std::size_t width) -> uint64_t
+{
+    uint64_t value{0};
+    for (std::size_t i = 0; i < width; i++)
+    {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(record[pos + i])) << (8 * i);
+    }
+    return value;
+}
+} // namespace
+
+auto encode_events(const std::string &record) -> std::string
+{
+    if (record.empty() || record.size() % 8 != 0)
+    {
+        return {};
+    }
+    std::string out{};
+    uint64_t previous{0};
+    for (std::size_t pos = 0; pos < record.size(); pos += 8)
+    {
+        const uint64_t timestamp = get_le(record, pos, 8);
+        if (timestamp < previous)
+        {
+            return {};
+        }
+        put_varint(out, timestamp - previous);
+        previous = timestamp;
+    }
+    return out;
+}
+
+auto encode_rates(const std::string &record) -> std::string
+{
+    if (record.empty() || record.size() % 4 != 0)
+    {
+        return {};
+    }
+    std::string out{};
+    for (std::size_t pos = 0; pos < record.size(); pos += 4)
+    {
+        put_varint(out, get_le(record, pos, 4));
+    }
+    return out;
+}
+
+stream_registry::stream_registry()
+{
+    add({stream_events, "events", port_events, encode_events});
+    add({stream_rates, "rates", port_rates, encode_rates});
+    add({stream_health, "health", port_health, nullptr});
+    add({stream_fragments, "fragments", port_fragments, nullptr});
+}
+
+auto stream_registry::add(const stream &s) -> bool
+{
+    if (s.port < min_app_port || s.port > max_app_port)
+    {
+        printf("Error: stream %s: port %u is not an application port\n", s.name, s.port);
+        return false;
+    }
+    if (by_id(s.id) != nullptr || by_port(s.port) != nullptr)
+    {
+        printf("Error: stream %s: id %u or port %u already taken\n", s.name, s.id, s.port);
+        return false;
+    }
+    m_streams.push_back(s);
+    return true;
+}
+
+auto stream_registry::by_id(uint8_t id) const -> const stream *
+{
+    for (const auto &s : m_streams)
+    {
+        if (s.id == id)
+        {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+auto stream_registry::by_port(uint8_t port) const -> const stream *
+{
+    for (const auto &s : m_streams)
+    {
+        if (s.port == port)
+        {
+            return &s;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,120 @@
+#include "../include/telemetry.h"
+#include "../include/metrics.h"
+
+namespace
+{
+// little endian fields as the arduino lays them out
+class reader
+{
+public:
+    explicit reader(const std::string &data)
+        : m_data{data} {}
+
+    auto u8() -> uint8_t
+    {
+        return static_cast<uint8_t>(byte());
+    }
+
+    auto u16() -> uint16_t
+    {
+        const uint32_t low = byte();
+        return static_cast<uint16_t>(low | (byte() << 8));
+    }
+
+    auto u32() -> uint32_t
+    {
+        const uint32_t low = u16();
+        return low | (static_cast<uint32_t>(u16()) << 16);
+    }
+
+private:
+    auto byte() -> uint32_t
+    {
+        return static_cast<uint8_t>(m_data[m_pos++]);
+    }
+
+    const std::string &m_data;
+    std::size_t m_pos{0};
+};
+} // namespace
+
+auto loop_stats::decode(const std::string &payload, loop_stats &stats) -> bool
+{
+    if (payload.size() < 28)
+    {
+        return false;
+    }
+    reader in{payload};
+    stats.loop_max_us = in.u32();
+    stats.loop_avg_us = in.u32();
+    stats.loops = in.u32();
+    stats.deferred = in.u32();
+    stats.rx_late_max_us = in.u32();
+    stats.job_late_max_us = in.u32();
+    stats.rx_windows = in.u16();
+    stats.rx_missed = in.u16();
+    return true;
+}
+
+void loop_stats::export_to(metrics &m) const
+{
+    m.set("loop_max_us", loop_max_us, "Longest pass through the arduino main loop in the last interval");
+    m.set("loop_avg_us", loop_avg_us, "Average pass through the arduino main loop in the last interval");
+    m.set("loop_deferred", deferred, "Loop passes that deferred serial work to LMIC jobs in the last interval");
+    m.set("rx_late_max_us", rx_late_max_us, "Latest start of an RX window job behind its schedule in the last interval");
+    m.set("job_late_max_us", job_late_max_us, "Latest start of any timed LMIC job behind its schedule in the last interval");
+    m.set("rx_windows", rx_windows, "RX windows opened in the last interval");
+    m.set("rx_missed", rx_missed, "RX windows opened after LMIC.rxtime in the last interval");
+}
+
+auto health::decode(const std::string &payload, health &h) -> bool
+{
+    if (payload.size() < 22)
+    {
+        return false;
+    }
+    reader in{payload};
+    h.free_sram = in.u16();
+    h.largest_block = in.u16();
+    h.serial_rx_high_water = in.u8();
+    h.queue_depth = in.u8();
+    h.opmode = in.u16();
+    h.datarate = in.u8();
+    h.seqno_up = in.u32();
+    h.rejected_checksum = in.u16();
+    h.rejected_overflow = in.u16();
+    h.serial_ring_high_water = in.u8();
+    h.uptime_s = in.u32();
+    return true;
+}
+
+void health::export_to(metrics &m) const
+{
+    m.set("free_sram_bytes", free_sram, "Free SRAM on the arduino");
+    m.set("largest_free_block_bytes", largest_block, "Largest block the arduino heap can still allocate");
+    m.set("serial_rx_high_water_bytes", serial_rx_high_water, "Most bytes seen waiting in the arduino UART receive buffer, 64 bytes, emptied on every loop pass");
+    m.set("serial_ring_high_water_bytes", serial_ring_high_water, "Most bytes drained from the UART and waiting for the arduino frame parser, of 128");
+    m.set("device_queue_depth", queue_depth, "Uplinks queued on the arduino");
+    m.set("lmic_opmode", opmode, "LMIC.opmode bit field");
+    m.set("lmic_datarate", datarate, "LMIC.datarate");
+    m.set("lmic_seqno_up", seqno_up, "LMIC.seqnoUp, the uplink frame counter");
+    m.set("rejected_checksum_total", rejected_checksum, "Serial frames the arduino dropped for a bad checksum");
+    m.set("rejected_overflow_total", rejected_overflow, "Uplinks the arduino refused, queue full or too long");
+    m.set("device_uptime_seconds", uptime_s, "Time since the arduino booted");
+}
+
+auto operator<<(std::ostream &os, const loop_stats &stats) -> std::ostream &
+{
+    return os << std::dec << "loop max " << stats.loop_max_us << "us avg " << stats.loop_avg_us
+              << "us over " << stats.loops << " passes, " << stats.deferred << " deferred, rx windows "
+              << stats.rx_windows << " missed " << stats.rx_missed << " late max " << stats.rx_late_max_us << "us, any job late max " << stats.job_late_max_us << "us";
+}
+
+auto operator<<(std::ostream &os, const health &h) -> std::ostream &
+{
+    return os << std::dec << "sram free " << h.free_sram << " largest " << h.largest_block << ", rx high water "
+              << static_cast<unsigned>(h.serial_rx_high_water) << " ring " << static_cast<unsigned>(h.serial_ring_high_water) << ", queue " << static_cast<unsigned>(h.queue_depth)
+              << ", opmode 0x" << std::hex << h.opmode << std::dec << " dr " << static_cast<unsigned>(h.datarate)
+              << " fcnt " << h.seqno_up << ", rejected checksum " << h.rejected_checksum << " overflow " << h.rejected_overflow
+              << ", up " << h.uptime_s << "s";
+}
@@ -0,0 +1,235 @@
+#include "../include/uplink_queue.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// keeps half of the 8 bit ids free for new uplinks
+constexpr std::size_t max_retired_ids{128};
+
+uplink_queue::uplink_queue(std::size_t f_capacity, std::size_t f_window, std::size_t f_interleave)
+    : m_capacity{f_capacity}
+    , m_window{f_window}
+    , m_interleave{f_interleave} {}
+
+auto uplink_queue::push(uplink record) -> bool
+{
+    if (record.payload.size() <= max_lora_payload)
+    {
+        if (size() >= m_capacity)
+        {
+            return false;
+        }
+        m_pending.push_back(std::move(record));
+        return true;
+    }
+    auto fragments = fragment(m_next_record_id, record.port, record.payload, max_lora_payload);
+    // all or nothing, half a record is of no use to anyone
+    if (fragments.empty() || size() + fragments.size() > m_capacity)
+    {
+        return false;
+    }
+    m_next_record_id++;
+    for (auto &f : fragments)
+    {
+        m_fragments.push_back({port_fragments, std::move(f), true});
+    }
+    return true;
+}
+
+auto uplink_queue::ready(clock::time_point now) const -> bool
+{
+    const bool waiting = !m_pending.empty() || !m_fragments.empty() || due_retry(now) != m_retry.end();
+    return waiting && m_in_flight.size() < m_window;
+}
+
+auto uplink_queue::take(uint8_t &id, clock::time_point now) -> uplink
+{
+    uplink record{};
+    auto retry = due_retry(now);
+    if (retry != m_retry.end())
+    {
+        // its turn came long ago
+        record = std::move(retry->record);
+        m_retry.erase(retry);
+    }
+    else
+    {
+        const bool use_fragment = m_pending.empty() || (!m_fragments.empty() && m_since_fragment >= m_interleave);
+        auto &lane = use_fragment ? m_fragments : m_pending;
+        m_since_fragment = use_fragment ? 0 : m_since_fragment + 1;
+        record = std::move(lane.front());
+        lane.pop_front();
+    }
+    // at most window + max_retired_ids of the 256 ids are taken
+    do
+    {
+        id = m_next_id++;
+    } while (id_in_use(id, now));
+    m_in_flight.push_back({id, std::move(record), now, false});
+    return m_in_flight.back().record;
+}
+
+void uplink_queue::queued(uint8_t id)
+{
+    auto it = find(id);
+    if (it != m_in_flight.end())
+    {
+        it->queued = true;
+    }
+}
+
+void uplink_queue::sending(uint8_t id)
+{
+    auto it = find(id);
+    if (it != m_in_flight.end())
+    {
+        it->queued = true;
+        it->sending = true;
+    }
+}
+
+void uplink_queue::done(uint8_t id)
+{
+    auto it = find(id);
+    if (it != m_in_flight.end())
+    {
+        m_in_flight.erase(it);
+    }
+}
+
+void uplink_queue::rejected(uint8_t id, clock::time_point now)
+{
+    auto it = find(id);
+    if (it == m_in_flight.end())
+    {
+        return;
+    }
+    auto &record = it->record;
+    if (++record.rejects >= uplink_max_rejects)
+    {
+        printf("dropping an uplink on port %u after %u rejects\n", record.port, record.rejects);
+        m_dropped++;
+    }
+    else
+    {
+        const auto not_before = now + uplink_reject_backoff * (1u << (record.rejects - 1));
+        m_retry.push_back({std::move(record), not_before});
+    }
+    m_in_flight.erase(it);
+}
+
+void uplink_queue::expire(clock::time_point now)
+{
+    for (auto it = m_retired.begin(); it != m_retired.end();)
+    {
+        it = (now - it->second > uplink_done_timeout) ? m_retired.erase(it) : std::next(it);
+    }
+    for (auto it = m_in_flight.begin(); it != m_in_flight.end();)
+    {
+        if (!it->queued && now - it->sent_at > uplink_ack_timeout)
+        {
+            // the arduino never saw it, most likely
+            m_ack_timeouts++;
+            requeue(*it);
+        }
+        else if (it->queued && now - it->sent_at > uplink_done_timeout)
+        {
+            m_done_timeouts++;
+        }
+        else
+        {
+            ++it;
+            continue;
+        }
+        retire(it->id, now);
+        it = m_in_flight.erase(it);
+    }
+}
+
+void uplink_queue::requeue_in_flight()
+{
+    // in the order they were sent, which is the arduino's order
+    auto on_air = std::find_if(m_in_flight.rbegin(), m_in_flight.rend(), [](const auto &entry) { return entry.sending; });
+    // oldest first, in front of everything still pending
+    for (auto it = m_in_flight.rbegin(); it != on_air; ++it)
+    {
+        requeue(*it);
+    }
+    m_unconfirmed += std::distance(on_air, m_in_flight.rend());
+    m_in_flight.clear();
+    // the arduino restarted, nothing will answer for the old ids
+    m_retired.clear();
+}
+
+auto uplink_queue::size() const -> std::size_t
+{
+    return m_pending.size() + m_fragments.size() + m_retry.size() + m_in_flight.size();
+}
+
+auto uplink_queue::in_flight() const -> std::size_t
+{
+    return m_in_flight.size();
+}
+
+auto uplink_queue::fill() const -> double
+{
+    return static_cast<double>(size()) / static_cast<double>(m_capacity);
+}
+
+auto uplink_queue::ack_timeouts() const -> unsigned long
+{
+    return m_ack_timeouts;
+}
+
+auto uplink_queue::done_timeouts() const -> unsigned long
+{
+    return m_done_timeouts;
+}
+
+auto uplink_queue::dropped() const -> unsigned long
+{
+    return m_dropped;
+}
+
+auto uplink_queue::unconfirmed() const -> unsigned long
+{
+    return m_unconfirmed;
+}
+
+auto uplink_queue::due_retry(clock::time_point now) const -> std::deque<retry_entry>::const_iterator
+{
+    return std::find_if(m_retry.begin(), m_retry.end(), [now](const auto &entry) { return entry.not_before <= now; });
+}
+
+auto uplink_queue::find(uint8_t id) -> std::deque<in_flight_entry>::iterator
+{
+    return std::find_if(m_in_flight.begin(), m_in_flight.end(), [id](const auto &entry) { return entry.id == id; });
+}
+
+auto uplink_queue::id_in_use(uint8_t id, clock::time_point now) const -> bool
+{
+    auto retired = m_retired.find(id);
+    if (retired != m_retired.end() && now - retired->second <= uplink_done_timeout)
+    {
+        return true;
+    }
+    return std::any_of(m_in_flight.begin(), m_in_flight.end(), [id](const auto &entry) { return entry.id == id; });
+}
+
+void uplink_queue::retire(uint8_t id, clock::time_point now)
+{
+    if (m_retired.size() >= max_retired_ids)
+    {
+        // a late answer for the oldest one may now be taken for a new uplink
+        m_retired.erase(std::min_element(m_retired.begin(), m_retired.end(), [](const auto &a, const auto &b) {
+            return a.second < b.second;
+        }));
+    }
+    m_retired[id] = now;
+}
+
+void uplink_queue::requeue(in_flight_entry &entry)
+{
+    auto &lane = entry.record.fragment ? m_fragments : m_pending;
+    lane.push_front(std::move(entry.record));
+}
@@ -0,0 +1,25 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+// failed checks so far, a test program exits with check_report()
+inline int check_failures{0};
+
+#define CHECK(condition)                                                               \
+    do                                                                                 \
+    {                                                                                  \
+        if (!(condition))                                                              \
+        {                                                                              \
+            printf("%s:%i: check failed: %s\n", __FILE__, __LINE__, #condition);       \
+            check_failures++;                                                          \
+        }                                                                              \
+    } while (0)
+
+inline auto check_report(const char *name) -> int
+{
+    printf("%s: %s\n", name, check_failures == 0 ? "ok" : "FAILED");
+    return check_failures == 0 ? 0 : 1;
+}
+
+#endif // CHECK_H
@@ -0,0 +1,163 @@
+#include "../include/fragment.h"
+#include "check.h"
+
+#include <algorithm>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+constexpr std::size_t payload{12};
+const reassembler::clock::time_point start{};
+
+// 25 bytes of data and the port byte in three fragments of at most 10 bytes
+const std::string data{"abcdefghijklmnopqrstuvwxy"};
+
+auto feed_all(reassembler &r, const std::vector<std::string> &fragments, reassembler::record &complete) -> int
+{
+    int completed{0};
+    for (const auto &f : fragments)
+    {
+        completed += r.feed(f, start, complete);
+    }
+    return completed;
+}
+
+void split()
+{
+    const auto fragments = fragment(7, 3, data, payload);
+    CHECK(fragments.size() == 3);
+    CHECK(fragments[0].substr(0, 3) == std::string("\x07\x00\x03", 3));
+    CHECK(static_cast<uint8_t>(fragments[1][1]) == 1);
+    CHECK(static_cast<uint8_t>(fragments[2][1]) == (2 | 0x80));
+    for (const auto &f : fragments)
+    {
+        CHECK(f.size() <= payload);
+    }
+    CHECK(fragment(0, 1, data, fragment_header_size).empty());
+    CHECK(fragment(0, 1, std::string(max_fragments * 10, 'x'), payload).empty());
+    CHECK(fragment(0, 1, std::string(max_fragments * 10 - 1, 'x'), payload).size() == max_fragments);
+}
+
+void in_order()
+{
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    CHECK(feed_all(r, fragment(1, 3, data, payload), complete) == 1);
+    CHECK(complete.port == 3);
+    CHECK(complete.data == data);
+    CHECK(r.buffered() == 0);
+}
+
+void reordered()
+{
+    auto fragments = fragment(1, 3, data, payload);
+    std::reverse(fragments.begin(), fragments.end());
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    CHECK(feed_all(r, fragments, complete) == 1);
+    CHECK(complete.data == data);
+}
+
+void missing()
+{
+    auto fragments = fragment(1, 3, data, payload);
+    fragments.erase(fragments.begin() + 1);
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    CHECK(feed_all(r, fragments, complete) == 0);
+    CHECK(r.buffered() > 0);
+}
+
+void duplicate()
+{
+    const auto fragments = fragment(1, 3, data, payload);
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    CHECK(!r.feed(fragments[0], start, complete));
+    CHECK(!r.feed(fragments[0], start, complete));
+    CHECK(!r.feed(fragments[1], start, complete));
+    CHECK(r.feed(fragments[2], start, complete));
+    CHECK(complete.data == data);
+    // after completion a late copy starts a new partial record and nothing more
+    CHECK(!r.feed(fragments[1], start, complete));
+}
+
+void stray()
+{
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    // left over from an older record with the same id, past the end of the new one
+    CHECK(!r.feed(std::string{7, 5} + "STALE", start, complete));
+    const auto fragments = fragment(7, 1, "short record data", payload);
+    CHECK(fragments.size() == 2);
+    CHECK(!r.feed(fragments[1], start, complete));
+    CHECK(r.feed(fragments[0], start, complete));
+    CHECK(complete.data == "short record data");
+
+    // past a known end
+    CHECK(!r.feed(fragments[1], start, complete));
+    CHECK(!r.feed(std::string{7, 3} + "STALE", start, complete));
+    CHECK(r.feed(fragments[0], start, complete));
+    CHECK(complete.data == "short record data");
+}
+
+void conflicting_ends()
+{
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    const auto longer = fragment(9, 1, data, payload);
+    const auto shorter = fragment(9, 1, "short record data", payload);
+    CHECK(!r.feed(longer[2], start, complete));
+    CHECK(!r.feed(longer[0], start, complete));
+    // a different end drops what was collected so far
+    CHECK(!r.feed(shorter[1], start, complete));
+    CHECK(r.dropped() == 1);
+    CHECK(r.feed(shorter[0], start, complete));
+    CHECK(complete.data == "short record data");
+}
+
+void timeout()
+{
+    const auto fragments = fragment(1, 3, data, payload);
+    reassembler r{60s, 4096};
+    reassembler::record complete{};
+    CHECK(!r.feed(fragments[0], start, complete));
+    CHECK(!r.feed(fragments[1], start + 30s, complete));
+    r.expire(start + 59s);
+    CHECK(r.dropped() == 0);
+    r.expire(start + 61s);
+    CHECK(r.dropped() == 1);
+    CHECK(r.buffered() == 0);
+    // the rest arrives too late and completes nothing
+    CHECK(!r.feed(fragments[2], start + 62s, complete));
+}
+
+void memory_cap()
+{
+    reassembler r{60s, 25};
+    reassembler::record complete{};
+    const auto first = fragment(1, 3, data, payload);
+    const auto second = fragment(2, 3, data, payload);
+    CHECK(!r.feed(first[0], start, complete));
+    CHECK(!r.feed(first[1], start, complete));
+    CHECK(!r.feed(second[0], start + 1s, complete));
+    // the oldest partial record made room
+    CHECK(r.dropped() == 1);
+    CHECK(r.buffered() == second[0].size() - fragment_header_size);
+}
+} // namespace
+
+int main()
+{
+    split();
+    in_order();
+    reordered();
+    missing();
+    duplicate();
+    stray();
+    conflicting_ends();
+    timeout();
+    memory_cap();
+    return check_report("test_fragment");
+}
@@ -0,0 +1,109 @@
+#include "../include/lorawan.h"
+#include "check.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+auto from_hex(const char *hex) -> std::string
+{
+    std::string out{};
+    for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2)
+    {
+        unsigned byte{0};
+        std::sscanf(hex, "%2x", &byte);
+        out += static_cast<char>(byte);
+    }
+    return out;
+}
+
+auto key_from_hex(const char *hex) -> aes_key
+{
+    const std::string bytes = from_hex(hex);
+    aes_key key{};
+    for (std::size_t i = 0; i < key.size() && i < bytes.size(); i++)
+    {
+        key[i] = static_cast<uint8_t>(bytes[i]);
+    }
+    return key;
+}
+
+// FIPS-197 appendix C.1
+void aes()
+{
+    std::string out{};
+    CHECK(aes_encrypt(key_from_hex("000102030405060708090a0b0c0d0e0f"), from_hex("00112233445566778899aabbccddeeff"), out));
+    CHECK(out == from_hex("69c4e0d86a7b0430d8cdb78070b4c55a"));
+}
+
+// RFC 4493 section 4, examples 1 to 4
+void cmac()
+{
+    const aes_key key = key_from_hex("2b7e151628aed2a6abf7158809cf4f3c");
+    const std::string message = from_hex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+                                         "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+    std::string out{};
+    CHECK(aes_cmac(key, "", out));
+    CHECK(out == from_hex("bb1d6929e95937287fa37d129b756746"));
+    CHECK(aes_cmac(key, message.substr(0, 16), out));
+    CHECK(out == from_hex("070a16b46b4d4144f79bdd9dd04a287c"));
+    CHECK(aes_cmac(key, message.substr(0, 40), out));
+    CHECK(out == from_hex("dfa66747de9ae63030ca32611497c827"));
+    CHECK(aes_cmac(key, message, out));
+    CHECK(out == from_hex("51f0bebf7e3b9d92fc49741779363cfe"));
+}
+
+// port 1 and "test" with FCnt 2, the example uplink of the lora-packet library
+void frame()
+{
+    lorawan_session session{};
+    session.devaddr = 0x49be7df1;
+    session.nwkskey = key_from_hex("44024241ed4ce9a68c6a8bc055233fd3");
+    session.appskey = key_from_hex("ec925802ae430ca77fd3dd73cb2cc588");
+    CHECK(lorawan_encoder::encode(session, 2, 1, "test") == from_hex("40f17dbe4900020001954378762b11ff0d"));
+
+    // the encoder counts up before every frame, as LMIC does
+    lorawan_encoder encoder{session, 1};
+    CHECK(encoder.encode(1, "test") == from_hex("40f17dbe4900020001954378762b11ff0d"));
+    CHECK(encoder.fcnt() == 2);
+}
+
+// Uplinks as LMIC put them on air. Capture them with the capture_frames environment
+// in arduino/platformio.ini, which logs "fcnt <n> frame <PHYPayload>" at EV_TXSTART,
+// and add the session, the FCnt, the port and the payload the raspi sent.
+struct lmic_frame
+{
+    uint32_t devaddr;
+    const char *nwkskey;
+    const char *appskey;
+    uint32_t fcnt;
+    uint8_t port;
+    const char *payload;
+    const char *phy_payload;
+};
+
+const std::vector<lmic_frame> lmic_frames{};
+
+void lmic()
+{
+    if (lmic_frames.empty())
+    {
+        printf("test_lorawan: no frames captured from LMIC yet\n");
+    }
+    for (const auto &f : lmic_frames)
+    {
+        const lorawan_session session{f.devaddr, key_from_hex(f.nwkskey), key_from_hex(f.appskey)};
+        CHECK(lorawan_encoder::encode(session, f.fcnt, f.port, from_hex(f.payload)) == from_hex(f.phy_payload));
+    }
+}
+} // namespace
+
+int main()
+{
+    aes();
+    cmac();
+    frame();
+    lmic();
+    return check_report("test_lorawan");
+}
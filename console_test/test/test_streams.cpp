@@ -0,0 +1,62 @@
+#include "../include/streams.h"
+#include "check.h"
+
+namespace
+{
+auto le(uint64_t value, std::size_t width) -> std::string
+{
+    std::string out{};
+    for (std::size_t i = 0; i < width; i++)
+    {
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    return out;
+}
+
+void events()
+{
+    // 1700000000000000000 ns, then 300 ns and 127 ns later
+    const std::string record = le(1700000000000000000ULL, 8) + le(1700000000000000300ULL, 8) + le(1700000000000000427ULL, 8);
+    const std::string payload = encode_events(record);
+    CHECK(payload == std::string("\x80\x80\xa8\xb1\xe3\x9f\xe7\xcb\x17" "\xac\x02" "\x7f", 12));
+    // a repeated timestamp is a zero difference
+    CHECK(encode_events(le(5, 8) + le(5, 8)) == std::string("\x05\x00", 2));
+    CHECK(encode_events(le(~0ULL, 8)).size() == 10);
+    CHECK(encode_events(le(6, 8) + le(5, 8)).empty());
+    CHECK(encode_events(std::string(12, '\0')).empty());
+    CHECK(encode_events("").empty());
+}
+
+void rates()
+{
+    CHECK(encode_rates(le(0, 4) + le(127, 4) + le(128, 4) + le(0xffffffff, 4))
+          == std::string("\x00" "\x7f" "\x80\x01" "\xff\xff\xff\xff\x0f", 9));
+    CHECK(encode_rates(std::string(6, '\0')).empty());
+    CHECK(encode_rates("").empty());
+}
+
+void registry()
+{
+    stream_registry streams{};
+    CHECK(streams.by_id(stream_events)->port == port_events);
+    CHECK(streams.by_id(stream_events)->encode == encode_events);
+    CHECK(streams.by_id(stream_rates)->encode == encode_rates);
+    CHECK(streams.by_port(port_health)->id == stream_health);
+    CHECK(streams.by_port(port_health)->encode == nullptr);
+    CHECK(streams.by_id(0x42) == nullptr);
+    CHECK(!streams.add({0x42, "mac", 0, nullptr}));
+    CHECK(!streams.add({0x42, "reserved", 224, nullptr}));
+    CHECK(!streams.add({stream_events, "twice", 10, nullptr}));
+    CHECK(!streams.add({0x42, "same port", port_rates, nullptr}));
+    CHECK(streams.add({0x42, "new", 10, nullptr}));
+    CHECK(streams.by_port(10)->id == 0x42);
+}
+} // namespace
+
+int main()
+{
+    events();
+    rates();
+    registry();
+    return check_report("test_streams");
+}
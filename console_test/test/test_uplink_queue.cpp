@@ -0,0 +1,180 @@
+#include "../include/uplink_queue.h"
+#include "check.h"
+
+using namespace std::chrono_literals;
+
+namespace
+{
+const uplink_queue::clock::time_point start{};
+
+auto record(char c) -> uplink
+{
+    return {port_events, std::string(1, c)};
+}
+
+void window()
+{
+    uplink_queue queue{16, 2};
+    CHECK(!queue.ready(start));
+    CHECK(queue.push(record('a')) && queue.push(record('b')) && queue.push(record('c')));
+    uint8_t a{0}, b{0}, c{0};
+    CHECK(queue.take(a, start).payload == "a");
+    CHECK(queue.take(b, start).payload == "b");
+    CHECK(a != b);
+    CHECK(!queue.ready(start));
+    queue.done(a);
+    CHECK(queue.ready(start));
+    CHECK(queue.take(c, start).payload == "c");
+    CHECK(queue.size() == 2);
+    CHECK(queue.fill() == 2.0 / 16);
+}
+
+void capacity()
+{
+    uplink_queue queue{2, 1};
+    CHECK(queue.push(record('a')) && queue.push(record('b')));
+    CHECK(!queue.push(record('c')));
+    // a long record needs room for all of its fragments
+    CHECK(!queue.push({port_events, std::string(max_lora_payload + 1, 'x')}));
+}
+
+void ack_timeout()
+{
+    uplink_queue queue{16, 2};
+    queue.push(record('a'));
+    uint8_t id{0};
+    queue.take(id, start);
+    queue.expire(start + uplink_ack_timeout);
+    CHECK(queue.in_flight() == 1);
+    queue.expire(start + uplink_ack_timeout + 1s);
+    CHECK(queue.in_flight() == 0);
+    CHECK(queue.ack_timeouts() == 1);
+    // back in its lane with a new id, a late answer for the old one changes nothing
+    uint8_t again{0};
+    CHECK(queue.take(again, start + 3s).payload == "a");
+    CHECK(again != id);
+    queue.done(id);
+    CHECK(queue.in_flight() == 1);
+}
+
+void done_timeout()
+{
+    uplink_queue queue{16, 2};
+    queue.push(record('a'));
+    uint8_t id{0};
+    queue.take(id, start);
+    queue.queued(id);
+    queue.expire(start + uplink_done_timeout / 2);
+    CHECK(queue.in_flight() == 1);
+    queue.expire(start + uplink_done_timeout + 1s);
+    CHECK(queue.size() == 0);
+    CHECK(queue.done_timeouts() == 1);
+}
+
+void reject_backoff()
+{
+    uplink_queue queue{16, 2};
+    queue.push(record('a'));
+    auto now = start;
+    uint8_t id{0};
+    queue.take(id, now);
+    for (unsigned rejects = 1; rejects < uplink_max_rejects; rejects++)
+    {
+        queue.rejected(id, now);
+        const auto backoff = uplink_reject_backoff * (1u << (rejects - 1));
+        CHECK(!queue.ready(now + backoff - 1ms));
+        CHECK(queue.ready(now + backoff));
+        now += backoff;
+        CHECK(queue.take(id, now).payload == "a");
+    }
+    queue.rejected(id, now);
+    CHECK(queue.size() == 0);
+    CHECK(queue.dropped() == 1);
+}
+
+void retry_does_not_block()
+{
+    uplink_queue queue{16, 2};
+    queue.push(record('a'));
+    queue.push(record('b'));
+    uint8_t id{0};
+    queue.take(id, start);
+    queue.rejected(id, start);
+    CHECK(queue.take(id, start).payload == "b");
+    CHECK(queue.take(id, start + uplink_reject_backoff).payload == "a");
+}
+
+void requeue_after_sending()
+{
+    uplink_queue queue{16, 4};
+    uint8_t ids[4]{};
+    for (char c : {'a', 'b', 'c', 'd'})
+    {
+        queue.push(record(c));
+    }
+    queue.push(record('e'));
+    for (auto &id : ids)
+    {
+        queue.take(id, start);
+        queue.queued(id);
+    }
+    // a went out and its DONE got lost, b is on air, c and d wait on the arduino
+    queue.sending(ids[1]);
+    queue.requeue_in_flight();
+    CHECK(queue.in_flight() == 0);
+    CHECK(queue.unconfirmed() == 2);
+    CHECK(queue.size() == 3);
+    uint8_t id{0};
+    CHECK(queue.take(id, start).payload == "c");
+    CHECK(queue.take(id, start).payload == "d");
+    CHECK(queue.take(id, start).payload == "e");
+}
+
+void requeue_none_sent()
+{
+    uplink_queue queue{16, 4};
+    queue.push(record('a'));
+    queue.push(record('b'));
+    uint8_t id{0};
+    queue.take(id, start);
+    queue.queued(id);
+    queue.take(id, start);
+    queue.requeue_in_flight();
+    CHECK(queue.unconfirmed() == 0);
+    CHECK(queue.take(id, start).payload == "a");
+    CHECK(queue.take(id, start).payload == "b");
+}
+
+void fragments_interleave()
+{
+    uplink_queue queue{64, 1, 2};
+    CHECK(queue.push({port_rates, std::string(max_lora_payload + 10, 'x')}));
+    for (char c : {'a', 'b', 'c'})
+    {
+        queue.push(record(c));
+    }
+    std::string order{};
+    uint8_t id{0};
+    while (queue.ready(start))
+    {
+        const auto u = queue.take(id, start);
+        order += u.fragment ? 'F' : u.payload[0];
+        queue.done(id);
+    }
+    CHECK(order == "abFcF");
+}
+} // namespace
+
+int main()
+{
+    window();
+    capacity();
+    ack_timeout();
+    done_timeout();
+    reject_backoff();
+    retry_does_not_block();
+    requeue_after_sending();
+    requeue_none_sent();
+    fragments_interleave();
+    return check_report("test_uplink_queue");
+}